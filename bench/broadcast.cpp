@@ -0,0 +1,54 @@
+// One broadcast of a large buffer with each of the broadcast algorithms.
+// With FLAT party 0 sends n - 1 copies itself, with TREE it sends log n and
+// with PIPELINE just one.
+//
+// usage: bench_broadcast [bytes] [parties ...]
+
+#include "common.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+double broadcast_time(const size_t n, const int port, const size_t bytes,
+		      const broadcast_algorithm algorithm)
+{
+    auto setup = [](Network &nw) {
+	nw.shm() = false;
+    };
+
+    auto body = [&](Network &nw) {
+	vector<u8> rbuf (bytes);
+	if (nw.id() == 0)
+	    nw.broadcast_send(std::make_shared<const buffer_t>(bytes, (u8)42), algorithm);
+	nw.broadcast_recv(0, rbuf, algorithm);
+    };
+
+    return bench::run_parties(n, port, setup, body);
+}
+
+int main(int argc, char** argv) {
+
+    const size_t bytes = argc > 1 ? stoul(argv[1]) : 100 << 20;
+    vector<size_t> sizes;
+    for (int i = 2; i < argc; i++)
+	sizes.push_back(stoul(argv[i]));
+    if (sizes.empty())
+	sizes = {8, 32};
+
+    int port = 19000;
+    const char *names[] = {"flat", "tree", "pipeline"};
+
+    cout << "parties,bytes,algorithm,seconds,MiB_per_sec\n";
+
+    for (size_t n : sizes) {
+	for (auto algorithm : {FLAT, TREE, PIPELINE}) {
+	    double t = broadcast_time(n, port, bytes, algorithm);
+	    port += n;
+	    cout << n << "," << bytes << "," << names[algorithm] << "," << t << ","
+		 << (double)bytes / (1 << 20) / t << "\n";
+	}
+    }
+}
@@ -0,0 +1,59 @@
+// Helpers shared by the benchmarks.
+
+#ifndef _NCOMM_BENCH_COMMON_HPP
+#define _NCOMM_BENCH_COMMON_HPP
+
+#include "../include/ncomm.hpp"
+
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+namespace ncomm {
+namespace bench {
+
+// Runs n parties on localhost, one thread each. setup is called on every
+// Network before it connects and body once it is connected. Returns the
+// longest time, in seconds, that any party spent in body. All parties use
+// address, which may also be a unix: address.
+inline double run_parties(
+    const size_t n,
+    const int port,
+    const std::function<void(Network&)> &setup,
+    const std::function<void(Network&)> &body,
+    const std::string &address = "127.0.0.1")
+{
+    std::vector<std::thread> parties;
+    std::vector<double> elapsed (n);
+
+    for (size_t i = 0; i < n; i++) {
+	parties.emplace_back([&, i]() {
+	    network_info_t info = {
+		.id = (partyid_t)i,
+		.size = n,
+		.addrs = std::vector<std::string>(n, address)
+	    };
+	    Network nw (info);
+	    nw.base_port() = port;
+	    setup(nw);
+	    nw.connect();
+
+	    auto start = std::chrono::steady_clock::now();
+	    body(nw);
+	    auto end = std::chrono::steady_clock::now();
+
+	    elapsed[i] = std::chrono::duration<double>(end - start).count();
+	    nw.close();
+	});
+    }
+
+    for (auto &p : parties)
+	p.join();
+
+    return *std::max_element(elapsed.begin(), elapsed.end());
+}
+
+} // bench
+} // ncomm
+
+#endif // _NCOMM_BENCH_COMMON_HPP
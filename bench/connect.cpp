@@ -0,0 +1,52 @@
+// Measures how long it takes n parties on localhost to set up a Network.
+
+#include "../include/ncomm.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+using namespace ncomm;
+using namespace std;
+
+double startup_time(const size_t n, const int port)
+{
+    vector<thread> parties;
+    vector<chrono::steady_clock::time_point> done (n);
+
+    auto start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < n; i++) {
+	parties.emplace_back([&, i]() {
+	    network_info_t info = {
+		.id = (partyid_t)i,
+		.size = n,
+		.addrs = vector<string>(n, "127.0.0.1")
+	    };
+	    Network nw (info);
+	    nw.base_port() = port;
+	    nw.shm() = false;
+	    nw.connect();
+	    done[i] = chrono::steady_clock::now();
+	    nw.close();
+	});
+    }
+
+    for (auto &p : parties)
+	p.join();
+
+    auto end = *max_element(done.begin(), done.end());
+    return chrono::duration<double, milli>(end - start).count();
+}
+
+int main() {
+
+    int port = 7000;
+
+    cout << "parties,startup_ms\n";
+
+    for (size_t n : {3, 7, 16, 32}) {
+	cout << n << "," << startup_time(n, port) << "\n";
+	port += n;
+    }
+}
@@ -0,0 +1,44 @@
+// Compares the round latency of exchange_all between the threaded and the
+// epoll based I/O engines.
+
+#include "common.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+double round_latency(const size_t n, const int port, const io_engine engine,
+		     const size_t rounds)
+{
+    auto setup = [&](Network &nw) {
+	nw.engine() = engine;
+	nw.shm() = false;
+    };
+
+    auto body = [&](Network &nw) {
+	vector<vector<u8>> sbufs (n, vector<u8>(8, (u8)nw.id()));
+	vector<vector<u8>> rbufs (n, vector<u8>(8));
+	for (size_t r = 0; r < rounds; r++)
+	    nw.exchange_all(sbufs, rbufs);
+    };
+
+    return bench::run_parties(n, port, setup, body) * 1e6 / rounds;
+}
+
+int main(int argc, char** argv) {
+
+    const size_t rounds = argc > 1 ? stoul(argv[1]) : 100;
+    int port = 12000;
+
+    cout << "parties,threaded_round_us,epoll_round_us\n";
+
+    for (size_t n : {4, 8, 16, 32, 64}) {
+	double a = round_latency(n, port, THREADED, rounds);
+	port += n;
+	double b = round_latency(n, port, EPOLL, rounds);
+	port += n;
+	cout << n << "," << a << "," << b << "\n";
+    }
+}
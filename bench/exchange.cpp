@@ -0,0 +1,47 @@
+// Time of a single exchange_all round with large buffers. Receives are
+// completed in whatever order the data arrives, so one slow peer no longer
+// holds up the rest.
+//
+// usage: bench_exchange [bytes per peer] [parties]
+
+#include "common.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+double exchange_time(const size_t n, const int port, const io_engine engine,
+		     const size_t bytes)
+{
+    auto setup = [&](Network &nw) {
+	nw.engine() = engine;
+	nw.shm() = false;
+    };
+
+    auto body = [&](Network &nw) {
+	vector<vector<u8>> sbufs (n, vector<u8>(bytes, (u8)nw.id()));
+	vector<vector<u8>> rbufs (n, vector<u8>(bytes));
+	nw.exchange_all(sbufs, rbufs);
+    };
+
+    return bench::run_parties(n, port, setup, body);
+}
+
+int main(int argc, char** argv) {
+
+    const size_t bytes = argc > 1 ? stoul(argv[1]) : 64 << 20;
+    const size_t n = argc > 2 ? stoul(argv[2]) : 8;
+    int port = 14000;
+    const char *names[] = {"threaded", "epoll", "uring"};
+
+    cout << "parties,bytes,engine,seconds,MiB_per_sec\n";
+
+    for (auto engine : {THREADED, EPOLL, URING}) {
+	double t = exchange_time(n, port, engine, bytes);
+	port += n;
+	cout << n << "," << bytes << "," << names[engine] << "," << t << ","
+	     << (double)(n - 1) * bytes / (1 << 20) / t << "\n";
+    }
+}
@@ -0,0 +1,99 @@
+// 16 concurrent sessions between n parties, each on a thread of its own,
+// run once over sub-networks of a single Network and once over 16 separate
+// Networks. Setup covers connecting (and creating the sub-networks), and the
+// sessions do exchange_all rounds.
+//
+// usage: bench_mux [parties] [sessions] [rounds] [bytes]
+
+#include "../include/ncomm.hpp"
+
+#include <chrono>
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+static size_t n, sessions, rounds, bytes;
+
+static void session(Network &nw)
+{
+    vector<vector<u8>> sbufs (n, vector<u8>(bytes, (u8)nw.id()));
+    vector<vector<u8>> rbufs (n, vector<u8>(bytes));
+    for (size_t r = 0; r < rounds; r++)
+	nw.exchange_all(sbufs, rbufs);
+}
+
+static double seconds_since(const chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// setup and run times of the slowest party.
+static void run(const bool mux, const int port, double &setup, double &time)
+{
+    vector<thread> parties;
+    vector<double> setups (n), times (n);
+
+    for (size_t i = 0; i < n; i++) {
+	parties.emplace_back([&, i]() {
+	    auto start = chrono::steady_clock::now();
+
+	    vector<std::unique_ptr<Network>> networks;
+	    vector<Network*> views;
+	    for (size_t s = 0; s < (mux ? 1 : sessions); s++) {
+		networks.emplace_back(new Network(network_info_t{
+		    .id = (partyid_t)i,
+		    .size = n,
+		    .addrs = vector<string>(n, "127.0.0.1")
+		}));
+		networks.back()->base_port() = port + s * n;
+		networks.back()->shm() = false;
+		networks.back()->connect();
+	    }
+	    for (size_t s = 0; s < sessions; s++)
+		views.push_back(mux ? &networks[0]->sub(s) : networks[s].get());
+
+	    setups[i] = seconds_since(start);
+	    start = chrono::steady_clock::now();
+
+	    vector<thread> threads;
+	    for (auto v : views)
+		threads.emplace_back([v]() { session(*v); });
+	    for (auto &t : threads)
+		t.join();
+
+	    times[i] = seconds_since(start);
+
+	    for (auto &nw : networks)
+		nw->close();
+	});
+    }
+
+    for (auto &p : parties)
+	p.join();
+
+    setup = *max_element(setups.begin(), setups.end());
+    time = *max_element(times.begin(), times.end());
+}
+
+int main(int argc, char** argv) {
+
+    n = argc > 1 ? stoul(argv[1]) : 3;
+    sessions = argc > 2 ? stoul(argv[2]) : 16;
+    rounds = argc > 3 ? stoul(argv[3]) : 1000;
+    bytes = argc > 4 ? stoul(argv[4]) : 1024;
+
+    cout << "parties,sessions,rounds,bytes,kind,sockets,setup_ms,run_s\n";
+
+    int port = 20000;
+    for (bool mux : {true, false}) {
+	double setup, time;
+	run(mux, port, setup, time);
+	port += sessions * n;
+	cout << n << "," << sessions << "," << rounds << "," << bytes << ","
+	     << (mux ? "sub" : "networks") << ","
+	     << (mux ? 1 : sessions) * n * (n - 1) / 2 << ","
+	     << setup * 1e3 << "," << time << "\n";
+    }
+}
@@ -0,0 +1,48 @@
+// Latency of exchange_with between two parties. For comparison the old
+// implementation, which sent from a fresh thread on every call, is timed as
+// well.
+//
+// usage: bench_pingpong [rounds]
+
+#include "common.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+double pingpong(const int port, const size_t rounds, const bool spawn)
+{
+    auto setup = [](Network &nw) {
+	nw.shm() = false;
+    };
+
+    auto body = [&](Network &nw) {
+	const partyid_t other = 1 - nw.id();
+	vector<u8> sbuf (8, (u8)nw.id());
+	vector<u8> rbuf (8);
+	for (size_t r = 0; r < rounds; r++) {
+	    if (spawn) {
+		std::thread sender ([&]() { nw.send_to(other, sbuf); });
+		nw.recv_from(other, rbuf);
+		sender.join();
+	    } else {
+		nw.exchange_with(other, sbuf, rbuf);
+	    }
+	}
+    };
+
+    return bench::run_parties(2, port, setup, body) * 1e6 / rounds;
+}
+
+int main(int argc, char** argv) {
+
+    const size_t rounds = argc > 1 ? stoul(argv[1]) : 100000;
+
+    cout << "rounds,thread_per_call_us,exchange_with_us\n";
+
+    double a = pingpong(15000, rounds, true);
+    double b = pingpong(15002, rounds, false);
+    cout << rounds << "," << a << "," << b << "\n";
+}
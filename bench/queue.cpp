@@ -0,0 +1,61 @@
+// Compares the throughput of SharedQueue and SPSCQueue when used the way
+// TCPChannel uses its send queue: one thread pushes copies of a payload, one
+// thread consumes them.
+
+#include "../include/ncomm.hpp"
+
+#include <chrono>
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+template <typename Q>
+double run(Q &queue, const size_t payload_size, const size_t count)
+{
+    vector<u8> payload (payload_size, 42);
+    size_t total = 0;
+
+    auto consumer = [&]() {
+	for (size_t i = 0; i < count; i++) {
+	    total += queue.front().size();
+	    queue.pop_front();
+	}
+    };
+
+    auto start = chrono::steady_clock::now();
+
+    thread c (consumer);
+    for (size_t i = 0; i < count; i++)
+	queue.push_back(payload);
+    c.join();
+
+    auto end = chrono::steady_clock::now();
+
+    if (total != payload_size * count)
+	throw runtime_error("lost messages");
+
+    return count / chrono::duration<double>(end - start).count();
+}
+
+int main() {
+
+    const vector<pair<size_t, size_t>> configs = {
+	{8, 1000000},
+	{1024, 500000},
+	{1024 * 1024, 2000}
+    };
+
+    cout << "payload,messages,shared_queue_msgs_per_sec,spsc_queue_msgs_per_sec\n";
+
+    for (auto &c : configs) {
+	SharedQueue<vector<u8>> shared;
+	SPSCQueue<vector<u8>> spsc;
+
+	double a = run(shared, c.first, c.second);
+	double b = run(spsc, c.first, c.second);
+
+	cout << c.first << "," << c.second << "," << (size_t)a << "," << (size_t)b << "\n";
+    }
+}
@@ -0,0 +1,40 @@
+// Passing a buffer all the way around a simulated ring, once hop by hop with
+// send_to() and recv_from() and once with pipeline_ring(). Prints simulated
+// time.
+//
+// usage: bench_ring [parties] [bytes] [latency ms] [bandwidth Mbps]
+
+#include "../include/ncomm.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+int main(int argc, char** argv) {
+
+    const size_t n = argc > 1 ? stoul(argv[1]) : 8;
+    const size_t bytes = argc > 2 ? stoul(argv[2]) : 16 << 20;
+
+    sim_link_t link;
+    link.latency = (argc > 3 ? stod(argv[3]) : 1) / 1e3;
+    link.bandwidth = (argc > 4 ? stod(argv[4]) : 1000) * 1e6;
+
+    double hop_by_hop = SimNetwork(n, link).run([&](Network &nw) {
+	vector<u8> buf (bytes, (u8)nw.id());
+	if (nw.id() > 0)
+	    nw.recv_from(nw.ident_of_prev(), buf);
+	if (nw.id() < n - 1)
+	    nw.send_to(nw.ident_of_next(), buf);
+    });
+
+    double pipelined = SimNetwork(n, link).run([&](Network &nw) {
+	vector<u8> buf (bytes, (u8)nw.id());
+	nw.pipeline_ring(0, buf);
+    });
+
+    cout << "parties,bytes,chunk,hop_by_hop_s,pipelined_s\n";
+    cout << n << "," << bytes << "," << NCOMM_RING_CHUNK << "," << hop_by_hop
+	 << "," << pipelined << "\n";
+}
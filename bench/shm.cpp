@@ -0,0 +1,52 @@
+// Throughput between two parties on the same host, over shared memory and
+// over loopback TCP.
+//
+// usage: bench_shm [message size] [messages]
+
+#include "common.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+double throughput(const int port, const bool shm, const size_t size,
+		  const size_t count)
+{
+    auto setup = [&](Network &nw) {
+	nw.shm() = shm;
+    };
+
+    // party 0 streams to party 1, which acknowledges the last message so
+    // that the sender's time covers the whole transfer.
+    auto body = [&](Network &nw) {
+	vector<u8> buf (size, 1);
+	vector<u8> ack (1);
+	if (nw.id() == 0) {
+	    auto shared = std::make_shared<const buffer_t>(buf);
+	    for (size_t i = 0; i < count; i++)
+		nw.send_to(1, shared);
+	    nw.recv_from(1, ack);
+	} else {
+	    for (size_t i = 0; i < count; i++)
+		nw.recv_from(0, buf);
+	    nw.send_to(0, ack);
+	}
+    };
+
+    double t = bench::run_parties(2, port, setup, body);
+    return (double)size * count / (1 << 20) / t;
+}
+
+int main(int argc, char** argv) {
+
+    const size_t size = argc > 1 ? stoul(argv[1]) : 1 << 20;
+    const size_t count = argc > 2 ? stoul(argv[2]) : 1000;
+
+    cout << "bytes,messages,tcp_MiB_per_sec,shm_MiB_per_sec\n";
+
+    double a = throughput(16000, false, size, count);
+    double b = throughput(16002, true, size, count);
+    cout << size << "," << count << "," << a << "," << b << "\n";
+}
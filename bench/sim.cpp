@@ -0,0 +1,42 @@
+// exchange_all rounds on a simulated WAN, reporting both the simulated time
+// and the wall time the simulation took.
+//
+// usage: bench_sim [parties] [rounds] [latency ms] [bandwidth Mbps]
+
+#include "../include/ncomm.hpp"
+
+#include <chrono>
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+int main(int argc, char** argv) {
+
+    const size_t n = argc > 1 ? stoul(argv[1]) : 8;
+    const size_t rounds = argc > 2 ? stoul(argv[2]) : 100;
+
+    sim_link_t link;
+    link.latency = (argc > 3 ? stod(argv[3]) : 50) / 1e3;
+    link.bandwidth = (argc > 4 ? stod(argv[4]) : 1000) * 1e6;
+    link.jitter = link.latency / 10;
+
+    cout << "parties,rounds,bytes,simulated_s,wall_s\n";
+
+    for (size_t size : {32, 1 << 10, 1 << 20}) {
+	SimNetwork sim (n, link);
+
+	auto start = chrono::steady_clock::now();
+	double t = sim.run([&](Network &nw) {
+	    vector<vector<u8>> sbufs (n, vector<u8>(size));
+	    vector<vector<u8>> rbufs (n, vector<u8>(size));
+	    for (size_t r = 0; r < rounds; r++)
+		nw.exchange_all(sbufs, rbufs);
+	});
+	auto end = chrono::steady_clock::now();
+
+	cout << n << "," << rounds << "," << size << "," << t << ","
+	     << chrono::duration<double>(end - start).count() << "\n";
+    }
+}
@@ -0,0 +1,184 @@
+// The whole benchmark suite in one go: ping-pong latency, unidirectional
+// and bidirectional throughput from 1 B up to max bytes, rounds per second
+// of the collective operations, and connection setup time. Prints a single
+// CSV table so results can be compared between commits.
+//
+// usage: bench_suite [parties] [max bytes] [shm|tcp]
+
+#include "common.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+static int port = 18000;
+static bool use_shm = true;
+
+// every run gets fresh ports, so we never wait for old sockets to go away.
+static int next_port(const size_t n)
+{
+    int p = port;
+    port += n + 1;
+    return p;
+}
+
+static void setup(Network &nw)
+{
+    nw.shm() = use_shm;
+}
+
+static void row(const string &benchmark, const size_t parties, const size_t bytes,
+		const size_t iterations, const double seconds, const double value,
+		const string &unit)
+{
+    cout << benchmark << "," << parties << "," << bytes << "," << iterations
+	 << "," << seconds << "," << value << "," << unit << endl;
+}
+
+// enough iterations to move a decent amount of data, but not forever.
+static size_t iterations_for(const size_t bytes)
+{
+    return std::max((size_t)4, std::min((size_t)10000, (size_t)(256 << 20) / bytes));
+}
+
+void pingpong(const size_t bytes, const size_t rounds)
+{
+    auto body = [&](Network &nw) {
+	const partyid_t other = 1 - nw.id();
+	vector<u8> sbuf (bytes, (u8)nw.id());
+	vector<u8> rbuf (bytes);
+	for (size_t r = 0; r < rounds; r++) {
+	    if (nw.id() == 0) {
+		nw.send_to(other, sbuf);
+		nw.recv_from(other, rbuf);
+	    } else {
+		nw.recv_from(other, rbuf);
+		nw.send_to(other, sbuf);
+	    }
+	}
+    };
+
+    const double t = bench::run_parties(2, next_port(2), setup, body);
+    row("pingpong", 2, bytes, rounds, t, t * 1e6 / rounds / 2, "us");
+}
+
+// party 0 streams to party 1, or both stream to each other at once. The
+// final one byte message makes sure the sender's clock covers delivery.
+void throughput(const size_t bytes, const size_t count, const bool both)
+{
+    auto body = [&](Network &nw) {
+	const partyid_t other = 1 - nw.id();
+	const bool sending = both || nw.id() == 0;
+	const bool receiving = both || nw.id() == 1;
+
+	auto sbuf = std::make_shared<const buffer_t>(sending ? bytes : 0, (u8)nw.id());
+	vector<u8> rbuf (receiving ? bytes : 0);
+	vector<u8> ack (1);
+
+	for (size_t i = 0; i < count; i++) {
+	    if (sending)
+		nw.send_to(other, sbuf);
+	    if (receiving)
+		nw.recv_from(other, rbuf);
+	}
+
+	if (receiving)
+	    nw.send_to(other, ack);
+	if (sending)
+	    nw.recv_from(other, ack);
+    };
+
+    const double t = bench::run_parties(2, next_port(2), setup, body);
+    const double mib = (double)bytes * count * (both ? 2 : 1) / (1 << 20);
+    row(both ? "bidirectional" : "unidirectional", 2, bytes, count, t, mib / t, "MiB/s");
+}
+
+void collective(const string &name, const size_t n, const size_t bytes,
+		const size_t rounds)
+{
+    auto body = [&](Network &nw) {
+	vector<vector<u8>> sbufs (n, vector<u8>(bytes, (u8)nw.id()));
+	vector<vector<u8>> rbufs (n, vector<u8>(bytes));
+
+	for (size_t r = 0; r < rounds; r++) {
+	    if (name == "exchange_all") {
+		nw.exchange_all(sbufs, rbufs);
+	    } else if (name == "exchange_ring") {
+		nw.exchange_ring(sbufs[0], rbufs[0]);
+	    } else if (name == "allgather") {
+		nw.allgather(sbufs[0], rbufs[0]);
+	    } else if (name == "allreduce") {
+		nw.allreduce<add_op<uint64_t>>(sbufs[0], rbufs[0]);
+	    } else {
+		// everyone takes a turn, so no single sender is the bottleneck.
+		const partyid_t broadcaster = r % n;
+		if (broadcaster == nw.id())
+		    nw.broadcast_send(sbufs[0]);
+		nw.broadcast_recv(broadcaster, rbufs[0]);
+	    }
+	}
+    };
+
+    const double t = bench::run_parties(n, next_port(n), setup, body);
+    row(name, n, bytes, rounds, t, rounds / t, "rounds/s");
+}
+
+void setup_time(const size_t n)
+{
+    vector<thread> parties;
+    vector<chrono::steady_clock::time_point> done (n);
+    const int p = next_port(n);
+
+    auto start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < n; i++) {
+	parties.emplace_back([&, i]() {
+	    network_info_t info = {
+		.id = (partyid_t)i,
+		.size = n,
+		.addrs = vector<string>(n, "127.0.0.1")
+	    };
+	    Network nw (info);
+	    nw.base_port() = p;
+	    setup(nw);
+	    nw.connect();
+	    done[i] = chrono::steady_clock::now();
+	    nw.close();
+	});
+    }
+
+    for (auto &t : parties)
+	t.join();
+
+    auto end = *max_element(done.begin(), done.end());
+    const double t = chrono::duration<double>(end - start).count();
+    row("setup", n, 0, 1, t, t * 1e3, "ms");
+}
+
+int main(int argc, char** argv) {
+
+    const size_t n = argc > 1 ? stoul(argv[1]) : 4;
+    const size_t max_bytes = argc > 2 ? stoul(argv[2]) : 256 << 20;
+    use_shm = argc > 3 ? string(argv[3]) != "tcp" : true;
+
+    cout << "benchmark,parties,bytes,iterations,seconds,value,unit" << endl;
+
+    for (size_t bytes : {1, 64, 1024})
+	pingpong(bytes, 10000);
+
+    for (size_t bytes = 1; bytes <= max_bytes; bytes *= 4)
+	throughput(bytes, iterations_for(bytes), false);
+
+    for (size_t bytes = 1; bytes <= max_bytes; bytes *= 4)
+	throughput(bytes, iterations_for(bytes), true);
+
+    for (auto name : {"exchange_all", "exchange_ring", "broadcast", "allgather", "allreduce"}) {
+	for (size_t bytes : {8, 1024, 65536})
+	    collective(name, n, bytes, std::min((size_t)10000, iterations_for(bytes * n)));
+    }
+
+    for (size_t parties : {(size_t)2, n, 2 * n})
+	setup_time(parties);
+}
@@ -0,0 +1,66 @@
+// Unix domain sockets against loopback TCP: round trip latency of small
+// messages and throughput of large ones between two parties.
+//
+// usage: bench_unix [round trips] [megabytes]
+
+#include "common.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+static void no_shm(Network &nw)
+{
+    nw.shm() = false;
+}
+
+double latency(const int port, const string &address, const size_t rounds)
+{
+    auto body = [&](Network &nw) {
+	vector<u8> sbuf (8, (u8)nw.id());
+	vector<u8> rbuf (8);
+	for (size_t r = 0; r < rounds; r++)
+	    nw.exchange_with(1 - nw.id(), sbuf, rbuf);
+    };
+
+    return bench::run_parties(2, port, no_shm, body, address) * 1e6 / rounds;
+}
+
+double throughput(const int port, const string &address, const size_t megabytes)
+{
+    auto body = [&](Network &nw) {
+	vector<u8> buf (1 << 20, 1);
+	vector<u8> ack (1);
+	if (nw.id() == 0) {
+	    auto shared = std::make_shared<const buffer_t>(buf);
+	    for (size_t i = 0; i < megabytes; i++)
+		nw.send_to(1, shared);
+	    nw.recv_from(1, ack);
+	} else {
+	    for (size_t i = 0; i < megabytes; i++)
+		nw.recv_from(0, buf);
+	    nw.send_to(0, ack);
+	}
+    };
+
+    return megabytes / bench::run_parties(2, port, no_shm, body, address);
+}
+
+int main(int argc, char** argv) {
+
+    const size_t rounds = argc > 1 ? stoul(argv[1]) : 10000;
+    const size_t megabytes = argc > 2 ? stoul(argv[2]) : 1000;
+
+    cout << "transport,round_trip_us,MiB_per_sec\n";
+
+    int port = 17000;
+    for (string address : {"127.0.0.1", "unix:/tmp"}) {
+	double l = latency(port, address, rounds);
+	port += 2;
+	double t = throughput(port, address, megabytes);
+	port += 2;
+	cout << (is_unix_address(address) ? "unix" : "tcp") << "," << l << "," << t << "\n";
+    }
+}
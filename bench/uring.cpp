@@ -0,0 +1,50 @@
+// Compares exchange_all rounds per second between the threaded and the
+// io_uring based I/O engines.
+
+#include "common.hpp"
+
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+double rounds_per_sec(const size_t n, const int port, const io_engine engine,
+		      const bool sqpoll, const size_t size, const size_t rounds)
+{
+    auto setup = [&](Network &nw) {
+	nw.engine() = engine;
+	nw.shm() = false;
+	nw.uring_sqpoll() = sqpoll;
+    };
+
+    auto body = [&](Network &nw) {
+	vector<vector<u8>> sbufs (n, vector<u8>(size, (u8)nw.id()));
+	vector<vector<u8>> rbufs (n, vector<u8>(size));
+	for (size_t r = 0; r < rounds; r++)
+	    nw.exchange_all(sbufs, rbufs);
+    };
+
+    return rounds / bench::run_parties(n, port, setup, body);
+}
+
+int main(int argc, char** argv) {
+
+    const size_t rounds = argc > 1 ? stoul(argv[1]) : 1000;
+    int port = 13000;
+
+    cout << "parties,bytes_per_peer,threaded_rounds_per_sec,"
+	 << "uring_rounds_per_sec,uring_sqpoll_rounds_per_sec\n";
+
+    for (size_t n : {3, 16}) {
+	for (size_t size : {8, 1 << 16}) {
+	    double a = rounds_per_sec(n, port, THREADED, false, size, rounds);
+	    port += n;
+	    double b = rounds_per_sec(n, port, URING, false, size, rounds);
+	    port += n;
+	    double c = rounds_per_sec(n, port, URING, true, size, rounds);
+	    port += n;
+	    cout << n << "," << size << "," << a << "," << b << "," << c << "\n";
+	}
+    }
+}
@@ -0,0 +1,63 @@
+// Sends many small messages back-to-back over a single TCPChannel and reports
+// how many write syscalls the sender thread saved by coalescing them.
+
+#include "../include/ncomm.hpp"
+
+#include <chrono>
+#include <iostream>
+
+using namespace ncomm;
+using namespace std;
+typedef unsigned char u8;
+
+int main(int argc, char** argv) {
+
+    const size_t count = argc > 1 ? stoul(argv[1]) : 1000000;
+    const size_t size = 16;
+    const int port = 6000;
+
+    channel_info_t server_info = {
+	.local_id = 1,
+	.remote_id = 0,
+	.port = port,
+	.hostname = NCOMM_LOCALHOST_IP,
+	.role = SERVER,
+	.local = true
+    };
+
+    channel_info_t client_info = {
+	.local_id = 0,
+	.remote_id = 1,
+	.port = port,
+	.hostname = "127.0.0.1",
+	.role = CLIENT,
+	.local = true
+    };
+
+    TCPChannel server (server_info);
+    TCPChannel client (client_info);
+
+    thread s ([&]() { server.connect(); });
+    client.connect();
+    s.join();
+
+    vector<u8> msg (size, 42);
+    vector<u8> all (count * size);
+
+    auto start = chrono::steady_clock::now();
+
+    thread r ([&]() { server.recv(all); });
+    for (size_t i = 0; i < count; i++)
+	client.send(msg);
+    r.join();
+
+    auto end = chrono::steady_clock::now();
+    double secs = chrono::duration<double>(end - start).count();
+
+    client.close();
+    server.close();
+
+    cout << "messages,message_size,seconds,msgs_per_sec,syscalls_saved\n";
+    cout << count << "," << size << "," << secs << "," << (size_t)(count / secs)
+	 << "," << client.syscalls_saved() << "\n";
+}
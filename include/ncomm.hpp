@@ -32,6 +32,15 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <map>
+#include <algorithm>
 
 // TODO: Not thread safe.
 #ifdef NCOMM_PRINT
@@ -46,6 +55,108 @@
 
 #define NCOMM_LOCALHOST_IP "0.0.0.0"
 
+// a client that cannot reach its server retries after a delay that starts
+// at NCOMM_CONNECT_BACKOFF_MIN milliseconds and doubles up to
+// NCOMM_CONNECT_BACKOFF_MAX.
+#ifndef NCOMM_CONNECT_BACKOFF_MIN
+#define NCOMM_CONNECT_BACKOFF_MIN 1
+#endif
+
+#ifndef NCOMM_CONNECT_BACKOFF_MAX
+#define NCOMM_CONNECT_BACKOFF_MAX 100
+#endif
+
+// the io_uring engine is built when the kernel headers for it are around.
+// Define NCOMM_NO_URING (make URING=0) to leave it out.
+#if !defined(NCOMM_NO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NCOMM_HAVE_URING
+#endif
+#endif
+
+#ifdef NCOMM_HAVE_URING
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+// coroutine versions of the network operations come with C++20 (make
+// COROUTINES=1). They are all in this header, so the library itself does
+// not have to be built as C++20.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define NCOMM_HAVE_COROUTINES
+#include <coroutine>
+#include <cerrno>
+#include <deque>
+#include <exception>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+#endif
+
+// size of the registered buffer each io_uring channel copies small writes
+// into.
+#ifndef NCOMM_URING_BUFFER_SIZE
+#define NCOMM_URING_BUFFER_SIZE (1 << 16)
+#endif
+
+// bytes an epoll channel reads ahead of its receives. With that much waiting
+// it stops reading, and the peer's writes back up instead.
+#ifndef NCOMM_EPOLL_STAGE_SIZE
+#define NCOMM_EPOLL_STAGE_SIZE (1 << 24)
+#endif
+
+struct iovec;
+struct io_uring_sqe;
+
+#ifndef NCOMM_CACHE_LINE
+#define NCOMM_CACHE_LINE 64
+#endif
+
+// number of times a waiting queue end polls before going to sleep.
+#ifndef NCOMM_SPIN_LIMIT
+#define NCOMM_SPIN_LIMIT 256
+#endif
+
+// number of messages a channel queues in its lock-free ring. Any more go to
+// a slower overflow list.
+#ifndef NCOMM_SEND_QUEUE_SIZE
+#define NCOMM_SEND_QUEUE_SIZE 4096
+#endif
+
+// bytes in the ring buffer of each direction of a shared memory channel. Must
+// be a power of two.
+#ifndef NCOMM_SHM_RING_SIZE
+#define NCOMM_SHM_RING_SIZE (1 << 22)
+#endif
+
+// Define NCOMM_HISTOGRAMS (make HISTOGRAMS=1) to have TCP channels record how
+// long messages sit in the send queue and how long receives block. Without
+// it the histograms are not compiled in at all.
+
+// events each thread can record in a trace session. Later events are
+// dropped.
+#ifndef NCOMM_TRACE_EVENTS
+#define NCOMM_TRACE_EVENTS (1 << 16)
+#endif
+
+// size of the pieces a pipelined broadcast is cut into.
+#ifndef NCOMM_BROADCAST_CHUNK
+#define NCOMM_BROADCAST_CHUNK (1 << 20)
+#endif
+
+// allgather and allreduce go around the ring once each party contributes at
+// least this many bytes, and exchange directly below that.
+#ifndef NCOMM_RING_THRESHOLD
+#define NCOMM_RING_THRESHOLD (1 << 16)
+#endif
+
+// size of the pieces Network::pipeline_ring() passes along.
+#ifndef NCOMM_RING_CHUNK
+#define NCOMM_RING_CHUNK (1 << 18)
+#endif
+
 namespace ncomm {
 
 template <typename T>
@@ -127,8 +238,442 @@ int SharedQueue<T>::size()
     return size;
 }
 
+// Sleep while word == expected, or until woken. Words in memory shared with
+// other processes need shared set.
+void futex_wait(std::atomic<uint32_t> &word, const uint32_t expected,
+		const bool shared = false);
+
+// Wake all threads sleeping on word.
+void futex_wake(std::atomic<uint32_t> &word, const bool shared = false);
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Lock-free queue for exactly one producer and one consumer thread.
+//
+// Pushing never blocks. Items go into a ring of fixed capacity, and once the
+// ring is full into an overflow list behind a mutex, until the consumer has
+// caught up and taken everything in it. Order is kept throughout.
+//
+// Waiting is adaptive: the consumer polls for NCOMM_SPIN_LIMIT iterations
+// and then sleeps on a futex. The producer only issues a wake-up syscall if
+// the consumer is actually asleep.
+template <typename T>
+class SPSCQueue
+{
+public:
+    SPSCQueue(const uint32_t capacity = NCOMM_SEND_QUEUE_SIZE);
+    ~SPSCQueue();
+
+    // producer.
+    void push_back(const T& item);
+    void push_back(T&& item);
+    // publishes both items at once.
+    void push_back(T&& first, T&& second);
+    void close();
+
+    // consumer. wait() blocks until an item is available and returns false
+    // if the queue was closed and everything has been consumed. at(i) gives
+    // access to the first available() items without removing them.
+    bool wait();
+    T& front();
+    T& at(const uint32_t i);
+    void pop_front();
+    void pop_front(const uint32_t count);
+    int available();
+
+    // number of items queued. Safe from either end.
+    int size();
+    bool empty();
+
+private:
+    // consumer. Sleeps until the ring holds more than head, something
+    // overflowed or the queue is closed.
+    void wait_while(const uint32_t head);
+    // moves the overflow list to the consumer's side. Only while the ring is
+    // empty, since everything in it is older.
+    bool take_overflow();
+
+    // producer
+    void notify();
+    template <typename U>
+    void _push_back(U&& item);
+    template <typename U>
+    void _overflow(U&& item);
+
+    const uint32_t _capacity;
+    std::vector<T> _slots;
+
+    // written by the consumer
+    alignas(NCOMM_CACHE_LINE) std::atomic<uint32_t> _head {0};
+    std::atomic<uint32_t> _consumer_waiting {0};
+    uint32_t _tail_cache = 0;
+    // overflowed items the consumer has taken. They come before the ring.
+    std::deque<T> _taken;
+
+    // written by the producer
+    alignas(NCOMM_CACHE_LINE) std::atomic<uint32_t> _tail {0};
+    // the consumer sleeps on this; it changes with every wake-up.
+    std::atomic<uint32_t> _wakeups {0};
+    std::atomic<bool> _closed {false};
+    uint32_t _head_cache = 0;
+
+    // the producer keeps to the overflow list while it is non-empty.
+    std::mutex _overflow_mutex;
+    std::deque<T> _overflow_items;
+    std::atomic<uint32_t> _overflowing {0};
+    // items in the overflow list or taken by the consumer.
+    std::atomic<uint32_t> _overflowed {0};
+};
+
+static inline uint32_t next_power_of_two(uint32_t x)
+{
+    uint32_t p = 1;
+    while (p < x)
+	p <<= 1;
+    return p;
+}
+
+template <typename T>
+SPSCQueue<T>::SPSCQueue(const uint32_t capacity)
+    : _capacity{next_power_of_two(capacity)},
+      _slots(_capacity)
+{
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+		  "futex words must be plain 32-bit integers");
+    assert(capacity > 0 && capacity <= (1u << 31));
+}
+
+template <typename T>
+SPSCQueue<T>::~SPSCQueue(){}
+
+template <typename T>
+void SPSCQueue<T>::wait_while(const uint32_t head)
+{
+    auto ready = [&]() {
+	return _tail.load(std::memory_order_acquire) != head
+	    || _overflowing.load(std::memory_order_acquire)
+	    || _closed.load(std::memory_order_acquire);
+    };
+
+    // spinning only pays off if the other end can run at the same time.
+    static const int spin_limit =
+	std::thread::hardware_concurrency() > 1 ? NCOMM_SPIN_LIMIT : 0;
+
+    for (int i = 0; i < spin_limit; i++) {
+	if (ready())
+	    return;
+	cpu_relax();
+    }
+
+    // pairs with the fence in notify(): either we see the new item, or the
+    // producer sees that we are waiting and wakes us. It bumps _wakeups
+    // first, so a wake-up that comes before we sleep is not lost.
+    for (;;) {
+	const uint32_t wakeups = _wakeups.load(std::memory_order_acquire);
+	_consumer_waiting.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (ready())
+	    break;
+	futex_wait(_wakeups, wakeups);
+    }
+    _consumer_waiting.store(0, std::memory_order_relaxed);
+}
+
+template <typename T>
+void SPSCQueue<T>::notify()
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // only the first notification after the consumer fell asleep needs a
+    // syscall.
+    if (_consumer_waiting.load(std::memory_order_relaxed)
+	&& _consumer_waiting.exchange(0, std::memory_order_relaxed)) {
+	_wakeups.fetch_add(1, std::memory_order_release);
+	futex_wake(_wakeups);
+    }
+}
+
+template <typename T>
+template <typename U>
+void SPSCQueue<T>::_overflow(U&& item)
+{
+    {
+	std::unique_lock<std::mutex> lock(_overflow_mutex);
+	_overflow_items.push_back(std::forward<U>(item));
+	_overflowed.fetch_add(1, std::memory_order_relaxed);
+	_overflowing.store(1, std::memory_order_release);
+    }
+    notify();
+}
+
+template <typename T>
+template <typename U>
+void SPSCQueue<T>::_push_back(U&& item)
+{
+    const uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+    // only the consumer clears _overflowing, so if we see it clear it is.
+    if (!_overflowing.load(std::memory_order_relaxed)) {
+	if (tail - _head_cache == _capacity)
+	    _head_cache = _head.load(std::memory_order_acquire);
+	if (tail - _head_cache < _capacity) {
+	    _slots[tail & (_capacity - 1)] = std::forward<U>(item);
+	    _tail.store(tail + 1, std::memory_order_release);
+	    notify();
+	    return;
+	}
+    }
+
+    _overflow(std::forward<U>(item));
+}
+
+template <typename T>
+void SPSCQueue<T>::push_back(const T& item)
+{
+    _push_back(item);
+}
+
+template <typename T>
+void SPSCQueue<T>::push_back(T&& item)
+{
+    _push_back(std::move(item));
+}
+
+template <typename T>
+void SPSCQueue<T>::push_back(T&& first, T&& second)
+{
+    assert(_capacity >= 2);
+    const uint32_t tail = _tail.load(std::memory_order_relaxed);
+
+    if (!_overflowing.load(std::memory_order_relaxed)) {
+	if (tail + 2 - _head_cache > _capacity)
+	    _head_cache = _head.load(std::memory_order_acquire);
+	if (tail + 2 - _head_cache <= _capacity) {
+	    _slots[tail & (_capacity - 1)] = std::move(first);
+	    _slots[(tail + 1) & (_capacity - 1)] = std::move(second);
+	    _tail.store(tail + 2, std::memory_order_release);
+	    notify();
+	    return;
+	}
+    }
+
+    {
+	std::unique_lock<std::mutex> lock(_overflow_mutex);
+	_overflow_items.push_back(std::move(first));
+	_overflow_items.push_back(std::move(second));
+	_overflowed.fetch_add(2, std::memory_order_relaxed);
+	_overflowing.store(1, std::memory_order_release);
+    }
+    notify();
+}
+
+template <typename T>
+void SPSCQueue<T>::close()
+{
+    _closed.store(true, std::memory_order_release);
+    _wakeups.fetch_add(1, std::memory_order_release);
+    futex_wake(_wakeups);
+}
+
+template <typename T>
+bool SPSCQueue<T>::take_overflow()
+{
+    if (!_overflowing.load(std::memory_order_acquire))
+	return false;
+
+    std::unique_lock<std::mutex> lock(_overflow_mutex);
+    for (auto &item : _overflow_items)
+	_taken.push_back(std::move(item));
+    _overflow_items.clear();
+    _overflowing.store(0, std::memory_order_release);
+    return !_taken.empty();
+}
+
+template <typename T>
+bool SPSCQueue<T>::wait()
+{
+    if (!_taken.empty())
+	return true;
+
+    const uint32_t head = _head.load(std::memory_order_relaxed);
+
+    if (_tail_cache != head)
+	return true;
+
+    _tail_cache = _tail.load(std::memory_order_acquire);
+    if (_tail_cache != head || take_overflow())
+	return true;
+
+    wait_while(head);
+    _tail_cache = _tail.load(std::memory_order_acquire);
+    return _tail_cache != head || take_overflow();
+}
+
+template <typename T>
+T& SPSCQueue<T>::front()
+{
+    const bool nonempty = wait();
+    assert(nonempty);
+    (void)nonempty;
+    return at(0);
+}
+
+template <typename T>
+int SPSCQueue<T>::available()
+{
+    const uint32_t head = _head.load(std::memory_order_relaxed);
+    const uint32_t ring = _tail.load(std::memory_order_acquire) - head;
+    if (ring == 0)
+	take_overflow();
+    return _taken.size() + ring;
+}
+
+template <typename T>
+T& SPSCQueue<T>::at(const uint32_t i)
+{
+    if (i >= _taken.size()
+	&& _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_relaxed))
+	take_overflow();
+    assert(i < (uint32_t)available());
+    if (i < _taken.size())
+	return _taken[i];
+    return _slots[(_head.load(std::memory_order_relaxed) + i - _taken.size()) & (_capacity - 1)];
+}
+
+template <typename T>
+void SPSCQueue<T>::pop_front()
+{
+    pop_front(1);
+}
+
+template <typename T>
+void SPSCQueue<T>::pop_front(const uint32_t n)
+{
+    const uint32_t taken = std::min(n, (uint32_t)_taken.size());
+    _taken.erase(_taken.begin(), _taken.begin() + taken);
+    _overflowed.fetch_sub(taken, std::memory_order_relaxed);
+
+    const uint32_t count = n - taken;
+    if (count == 0)
+	return;
+
+    const uint32_t head = _head.load(std::memory_order_relaxed);
+    // release whatever the items hold on to (e.g., a large buffer) now rather
+    // than when the slots are reused.
+    for (uint32_t i = 0; i < count; i++)
+	_slots[(head + i) & (_capacity - 1)] = T();
+    // available() may have seen more items than wait() did.
+    if ((int32_t)(head + count - _tail_cache) > 0)
+	_tail_cache = head + count;
+    _head.store(head + count, std::memory_order_release);
+}
+
+template <typename T>
+int SPSCQueue<T>::size()
+{
+    return _tail.load(std::memory_order_acquire)
+	- _head.load(std::memory_order_acquire)
+	+ _overflowed.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+bool SPSCQueue<T>::empty()
+{
+    return size() == 0;
+}
+
+// A histogram of durations in nanoseconds with logarithmic buckets, in the
+// style of HdrHistogram: every power of two is split into 2^sub_bits buckets,
+// so values are kept to within 1/2^sub_bits of their size. record() may only
+// be called from one thread at a time; reading is safe from anywhere.
+class Histogram {
+public:
+
+    static constexpr int sub_bits = 3;
+    static constexpr int buckets = (65 - sub_bits) << sub_bits;
+
+    Histogram();
+
+    void record(const uint64_t ns);
+    void record(const std::chrono::steady_clock::duration d) {
+	record(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    };
+    void reset();
+
+    uint64_t count() const;
+    uint64_t max() const;
+    double mean() const;
+    // smallest value that at least fraction q of all values are at most,
+    // rounded down to its bucket.
+    uint64_t quantile(const double q) const;
+
+    std::string to_string() const;
+    std::string to_json() const;
+
+    // index of the bucket v falls in, and the smallest value in bucket i.
+    static int bucket(const uint64_t v);
+    static uint64_t lower_bound(const int i);
+
+private:
+
+    std::atomic<uint64_t> _counts[buckets];
+    std::atomic<uint64_t> _count {0};
+    std::atomic<uint64_t> _sum {0};
+    std::atomic<uint64_t> _max {0};
+};
+
+// Tracing. Every thread appends begin and end events to a buffer of its own,
+// so recording takes no locks. Events belong to a session (one per traced
+// Network) and are exported per session in the Chrome Trace Event format,
+// which Perfetto and chrome://tracing can show. Session 0 means tracing is
+// off and records nothing.
+//
+// Each thread gets a buffer per session, which grows in chunks as events come
+// in. trace_end_session() frees the buffers of a session, and anything
+// recorded for it afterwards is dropped.
+uint32_t trace_new_session();
+void trace_end_session(const uint32_t session);
+void trace_event(const uint32_t session, const char *name, const char phase,
+		 const int peer, const uint64_t bytes);
+// all events of a session as a JSON trace, with pid set to party.
+std::string trace_json(const uint32_t session, const unsigned party);
+
+// records a begin event now and the matching end event when it goes out of
+// scope.
+class TraceScope {
+public:
+
+    TraceScope(const uint32_t session, const char *name, const int peer = -1,
+	       const uint64_t bytes = 0)
+	: _session{session},
+	  _name{name},
+	  _peer{peer},
+	  _bytes{bytes}
+	{
+	    if (_session)
+		trace_event(_session, _name, 'B', _peer, _bytes);
+	};
+
+    ~TraceScope() {
+	if (_session)
+	    trace_event(_session, _name, 'E', _peer, _bytes);
+    };
+
+private:
+    const uint32_t _session;
+    const char *_name;
+    const int _peer;
+    const uint64_t _bytes;
+};
+
 typedef unsigned int  partyid_t;
 
+typedef std::vector<unsigned char> buffer_t;
+
 enum channel_role {
     SERVER,
     CLIENT,
@@ -142,11 +687,91 @@ typedef struct {
     int             port;
     std::string     hostname;
     channel_role    role;
+    // both parties run on this host.
+    bool            local;
 
     std::string to_string() const;
 
 } channel_info_t;
 
+// What a channel has done since it was created or its stats were reset.
+// recv_seconds is how long receives were outstanding, which for a plain
+// recv() is the time it blocked.
+struct channel_stats_t {
+    uint64_t bytes_sent = 0;
+    uint64_t messages_sent = 0;
+    uint64_t bytes_received = 0;
+    uint64_t messages_received = 0;
+    double recv_seconds = 0;
+    // most messages the channel had queued but not yet written.
+    uint64_t send_queue_high_water = 0;
+
+    channel_stats_t& operator+=(const channel_stats_t &other);
+};
+
+// The live counters behind channel_stats_t. Sends and receives usually happen
+// on different threads, so each side gets its own cache line. Relaxed atomics
+// are enough: nobody synchronizes through them.
+struct channel_counters_t {
+    alignas(NCOMM_CACHE_LINE) std::atomic<uint64_t> bytes_sent {0};
+    std::atomic<uint64_t> messages_sent {0};
+    std::atomic<uint64_t> send_queue_high_water {0};
+
+    alignas(NCOMM_CACHE_LINE) std::atomic<uint64_t> bytes_received {0};
+    std::atomic<uint64_t> messages_received {0};
+    std::atomic<uint64_t> recv_nanoseconds {0};
+};
+
+class Channel;
+
+struct completion_state_t {
+    std::atomic<uint32_t> done {0};
+    Channel *recv = nullptr;
+    // eventfd to signal when a send completes, or -1.
+    std::mutex mutex;
+    int notify = -1;
+};
+
+// Handle of an asynchronous send or receive. A send is complete once the
+// channel is done with the buffer (which, for a send to ourselves, is when we
+// receive it), and a receive once the data is in the buffer. Copies refer to
+// the same operation. A default constructed handle is complete.
+class Completion {
+public:
+
+    Completion() {};
+
+    // true if the operation is complete. Makes progress on receives.
+    bool test();
+    void wait();
+
+    // a descriptor to poll for progress on a receive, or -1.
+    int fd() const;
+
+    // have a send write to the eventfd efd once it completes (or right away
+    // if it already has), so that it can be polled along with receives. Once
+    // notify(-1) returns, efd is not written to anymore.
+    void notify(const int efd);
+
+    bool is_recv() const {
+	return _state && _state->recv;
+    };
+
+private:
+
+    friend class Channel;
+
+    Completion(std::shared_ptr<completion_state_t> state)
+	: _state{state}
+	{};
+
+    std::shared_ptr<completion_state_t> _state;
+};
+
+// waits for all handles, completing receives in whatever order the data
+// arrives.
+void wait_all(std::vector<Completion> &handles);
+
 class Channel {
 public:
 
@@ -173,9 +798,87 @@ public:
 
     virtual void connect() = 0;
     virtual void close() = 0;
-    virtual void send(const std::vector<unsigned char> &buf) = 0;
+    // The rvalue and shared pointer overloads hand the buffer over without
+    // copying it. A shared buffer must not be modified after it is sent.
+    virtual void send(const std::vector<unsigned char> &buf) {
+	send(std::make_shared<buffer_t>(buf));
+    };
+    virtual void send(buffer_t &&buf) {
+	send(std::make_shared<buffer_t>(std::move(buf)));
+    };
+    virtual void send(std::shared_ptr<const buffer_t> buf) = 0;
     virtual void recv(std::vector<unsigned char> &buf) = 0;
 
+    // Sends header and payload back to back, in one write if the channel
+    // gathers writes.
+    virtual void send(std::shared_ptr<const buffer_t> header,
+		      std::shared_ptr<const buffer_t> payload) {
+	send(std::move(header));
+	send(std::move(payload));
+    };
+
+    // Framed messages carry their own length, so the receiver does not need
+    // to know it in advance. send_message() prefixes the payload with a
+    // varint length and recv_message() resizes buf to fit what arrives.
+    // Framed and plain messages may be mixed on a channel as long as both
+    // ends agree on the order.
+    void send_message(const std::vector<unsigned char> &buf) {
+	send_message(std::make_shared<buffer_t>(buf));
+    };
+    void send_message(buffer_t &&buf) {
+	send_message(std::make_shared<buffer_t>(std::move(buf)));
+    };
+    void send_message(std::shared_ptr<const buffer_t> buf);
+    virtual void recv_message(std::vector<unsigned char> &buf);
+
+    // Split receive. recv_start() begins receiving into buf, which must stay
+    // alive until the matching recv_wait() returns. recv_test() makes progress
+    // without blocking and returns true once recv_wait() would not block.
+    // Unless a channel can do better, the whole receive happens in
+    // recv_wait(), and recv_test() blocks for it.
+    virtual void recv_start(std::vector<unsigned char> &buf) {
+	_pending_recv = &buf;
+	_pending_data = nullptr;
+    };
+
+    // The same into size bytes at data, such as a slice of a larger buffer.
+    // Channels that receive into memory they do not own override both
+    // overloads; the others receive into a buffer of their own and copy.
+    virtual void recv_start(unsigned char *data, const size_t size) {
+	_pending_copy.resize(size);
+	_pending_recv = &_pending_copy;
+	_pending_data = data;
+    };
+
+    virtual void recv_wait() {
+	if (_pending_recv)
+	    recv(*_pending_recv);
+	if (_pending_data)
+	    std::copy(_pending_copy.begin(), _pending_copy.end(), _pending_data);
+	_pending_recv = nullptr;
+	_pending_data = nullptr;
+    };
+
+    virtual bool recv_test() {
+	recv_wait();
+	return true;
+    };
+
+    // A descriptor that polls readable when recv_test() can make progress, or
+    // -1 if there is none.
+    virtual int fd() const {
+	return -1;
+    };
+
+    // Asynchronous versions of send() and recv(). A channel has at most one
+    // receive going at a time, so a receive handle must complete before the
+    // next receive on the same channel.
+    Completion send_async(const std::vector<unsigned char> &buf) {
+	return send_async(buffer_t(buf));
+    };
+    Completion send_async(buffer_t &&buf);
+    Completion recv_async(std::vector<unsigned char> &buf);
+
     std::string to_string() const {
 	return info().to_string();
     };
@@ -184,6 +887,24 @@ public:
 	return _alive;
     };
 
+    channel_stats_t stats() const;
+    void reset_stats();
+
+    // the trace session the channel records its writes in.
+    uint32_t& trace_session() {
+	return _trace_session;
+    };
+
+    // time from send() until the message was written, and from the start of
+    // each receive until it completed. Null if the channel keeps no
+    // histograms.
+    virtual const Histogram* send_histogram() const {
+	return nullptr;
+    };
+    virtual const Histogram* recv_histogram() const {
+	return nullptr;
+    };
+
 protected:
 
     channel_info_t _info;
@@ -192,6 +913,76 @@ protected:
     partyid_t _local_id;
 
     bool _alive;
+
+    std::vector<unsigned char> *_pending_recv = nullptr;
+    // where the data of a receive into raw memory goes once it is in.
+    unsigned char *_pending_data = nullptr;
+    std::vector<unsigned char> _pending_copy;
+
+    // copies up to n bytes that have arrived but not been received into
+    // data, once there are more than have of them. Returns how many, or 0 if
+    // the channel cannot look ahead or nothing more will come. recv_message()
+    // finds the header with it instead of reading a byte at a time.
+    virtual size_t _peek(unsigned char *, const size_t, const size_t) {
+	return 0;
+    };
+
+    // for channels to keep their counters up to date. queued is the number
+    // of messages waiting to be written, including this one.
+    void _count_send(const size_t bytes, const size_t queued) {
+	_counters.bytes_sent.fetch_add(bytes, std::memory_order_relaxed);
+	_counters.messages_sent.fetch_add(1, std::memory_order_relaxed);
+	if (queued > _counters.send_queue_high_water.load(std::memory_order_relaxed))
+	    _counters.send_queue_high_water.store(queued, std::memory_order_relaxed);
+    };
+
+    // called when a receive of size bytes starts and when it is done.
+    // _recv_done() returns how long the receive took in nanoseconds, or -1
+    // for extra calls, which are ignored.
+    void _recv_begin(const size_t size) {
+	if (_recv_frame) {
+	    _recv_size += size;
+	    return;
+	}
+	_recv_size = size;
+	_recv_since = std::chrono::steady_clock::now();
+	_recv_open = true;
+    };
+
+    int64_t _recv_done() {
+	if (!_recv_open || _recv_frame)
+	    return -1;
+	_recv_open = false;
+	const int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now() - _recv_since).count();
+	_counters.bytes_received.fetch_add(_recv_size, std::memory_order_relaxed);
+	_counters.messages_received.fetch_add(1, std::memory_order_relaxed);
+	_counters.recv_nanoseconds.fetch_add(elapsed, std::memory_order_relaxed);
+	return elapsed;
+    };
+
+    // everything received in between counts as a single receive, as it
+    // does for the reads of a framed message.
+    void _frame_begin() {
+	_recv_begin(0);
+	_recv_frame = true;
+    };
+
+    int64_t _frame_done() {
+	_recv_frame = false;
+	return _recv_done();
+    };
+
+    channel_counters_t _counters;
+
+    uint32_t _trace_session = 0;
+
+private:
+
+    bool _recv_frame = false;
+    size_t _recv_size = 0;
+    std::chrono::steady_clock::time_point _recv_since;
+    bool _recv_open = false;
 };
 
 class DummyChannel : public Channel {
@@ -213,36 +1004,634 @@ public:
 	this->_alive = false;
     };
 
+    // messages are queued and handed to recv() in order. Buffers we own are
+    // moved out rather than copied.
     void send(const std::vector<unsigned char> &buf);
+    void send(buffer_t &&buf);
+    void send(std::shared_ptr<const buffer_t> buf);
     void recv(std::vector<unsigned char> &buf);
 
+    // nothing goes over the wire, so there is no need for a header.
+    void send(std::shared_ptr<const buffer_t>,
+	      std::shared_ptr<const buffer_t> payload) {
+	send(std::move(payload));
+    };
+    void recv_message(std::vector<unsigned char> &buf) {
+	recv(buf);
+    };
+
 private:
-    std::vector<unsigned char> _buffer;
+
+    // a message is either our own copy, or shared with the sender.
+    struct message_t {
+	buffer_t owned;
+	std::shared_ptr<const buffer_t> shared;
+    };
+
+    std::deque<message_t> _queue;
 };
 
-class TCPChannel : public Channel {
+// Addresses of the form unix:/some/dir name a directory instead of a host. The
+// party that would listen on TCP port p listens on the AF_UNIX socket
+// /some/dir/ncomm-p.sock instead.
+bool is_unix_address(const std::string &address);
+std::string unix_socket_path(const std::string &address, const int port);
+
+// A channel that talks to its peer over a stream socket. On its own, a server
+// channel listens on info().port for its peer (or the matching Unix socket if
+// info().hostname is a unix: address). Inside a Network all server channels
+// share one listener and are handed their socket through attach() instead.
+class SocketChannel : public Channel {
 public:
 
     using Channel::Channel;
 
-    ~TCPChannel() {};
-
     void connect();
-    void close();
+    virtual void attach(const int sock) = 0;
 
-    void send(const std::vector<unsigned char> &buf);
-    void recv(std::vector<unsigned char> &buf);
+protected:
 
-private:
+    // both return a connected socket.
+    int connect_as_server();
+    int connect_as_client();
+};
+
+class TCPChannel : public SocketChannel {
+public:
+
+    using SocketChannel::SocketChannel;
+
+    ~TCPChannel() {
+	close();
+    };
+
+    void attach(const int sock);
+    void close();
+
+    using Channel::send;
+    void send(std::shared_ptr<const buffer_t> buf);
+    void send(std::shared_ptr<const buffer_t> header,
+	      std::shared_ptr<const buffer_t> payload);
+    void recv(std::vector<unsigned char> &buf);
+
+    // peeks at the header, so a message takes two reads.
+    void recv_message(std::vector<unsigned char> &buf);
+
+    void recv_start(std::vector<unsigned char> &buf) {
+	recv_start(buf.data(), buf.size());
+    };
+    void recv_start(unsigned char *data, const size_t size);
+    void recv_wait();
+    bool recv_test();
+
+    int fd() const {
+	return _sock;
+    };
+
+    // number of write syscalls avoided by coalescing queued messages.
+    size_t syscalls_saved() const {
+	return _syscalls_saved.load(std::memory_order_relaxed);
+    };
+
+#ifdef NCOMM_HISTOGRAMS
+    const Histogram* send_histogram() const {
+	return &_send_histogram;
+    };
+    const Histogram* recv_histogram() const {
+	return &_recv_histogram;
+    };
+#endif
+
+protected:
+
+    // take over a connected socket.
+    void _start(const int sock);
+
+private:
+
+    SPSCQueue<std::shared_ptr<const buffer_t>> send_queue;
+    std::thread _sender;
+    std::atomic<size_t> _syscalls_saved {0};
+
+#ifdef NCOMM_HISTOGRAMS
+    // when each message in send_queue was queued.
+    SPSCQueue<std::chrono::steady_clock::time_point> _send_times;
+    Histogram _send_histogram;
+    Histogram _recv_histogram;
+#endif
 
-    SharedQueue<std::vector<unsigned char>> send_queue;
+    void _sender_loop();
+    size_t _send(struct iovec *iov, int iovcnt);
 
-    void _send(const unsigned char *buf, const size_t length);
+    // read at most what is left of the current receive. Returns false if
+    // the socket would block.
+    bool _recv_some(const int flags);
 
-    void connect_as_server();
-    void connect_as_client();
+    // what _recv_done() or _frame_done() returned, into the histogram.
+    void _recv_record(const int64_t elapsed);
 
     int _sock;
+
+    unsigned char *_recv_buf = nullptr;
+    size_t _recv_rem = 0;
+};
+
+// A TCPChannel over an AF_UNIX stream socket, which skips the checksums,
+// acknowledgements and congestion control of loopback TCP. Used for unix:
+// addresses.
+class UnixChannel : public TCPChannel {
+public:
+
+    using TCPChannel::TCPChannel;
+
+    void attach(const int sock) {
+	_start(sock);
+    };
+};
+
+class EpollChannel;
+
+// An event loop that owns a set of non-blocking sockets and moves data
+// between them and the queues of their EpollChannels.
+class Reactor {
+public:
+
+    Reactor();
+    ~Reactor();
+
+    // change which events of sock (owned by chl) are watched.
+    void control(EpollChannel *chl, const int sock, const uint32_t old_events,
+		 const uint32_t new_events);
+
+    // returns once the event loop no longer touches chl.
+    void remove(EpollChannel *chl, const int sock);
+
+private:
+
+    void run();
+    void notify();
+
+    int _epfd;
+    int _evfd;
+    bool _running = true;
+
+    std::mutex _mutex;
+    std::condition_variable _removed;
+    std::vector<std::pair<EpollChannel*, int>> _removals;
+    uint64_t _batches_started = 0;
+    uint64_t _batches_done = 0;
+
+    std::thread _thread;
+};
+
+// A TCP channel driven by a Reactor instead of its own sender thread.
+//
+// send() and recv() try to complete on the calling thread and leave whatever
+// would block to the reactor. Data that arrives before anybody asked for it is
+// staged in memory, up to NCOMM_EPOLL_STAGE_SIZE bytes, so a peer is rarely
+// stalled on a full socket buffer.
+class EpollChannel : public SocketChannel {
+public:
+
+    EpollChannel(const channel_info_t info, std::shared_ptr<Reactor> reactor)
+	: SocketChannel{info},
+	  _reactor{reactor}
+	{};
+
+    ~EpollChannel() {
+	close();
+    };
+
+    void attach(const int sock);
+    void close();
+
+    using Channel::send;
+    void send(std::shared_ptr<const buffer_t> buf);
+    void send(std::shared_ptr<const buffer_t> header,
+	      std::shared_ptr<const buffer_t> payload);
+    void recv(std::vector<unsigned char> &buf);
+
+    void recv_start(std::vector<unsigned char> &buf) {
+	recv_start(buf.data(), buf.size());
+    };
+    void recv_start(unsigned char *data, const size_t size);
+    void recv_wait();
+    bool recv_test();
+
+    // an eventfd the reactor signals once the receive is complete. The
+    // socket itself is no use, since the reactor drains it.
+    int fd() const;
+
+private:
+
+    friend class Reactor;
+
+    // looks in the staging buffer.
+    size_t _peek(unsigned char *data, const size_t n, const size_t have);
+
+    // called by the reactor.
+    void on_event(const uint32_t events);
+
+    // called with _mutex held.
+    void send_queued();
+    void flush();
+    void fill();
+    void update_events();
+    void signal() const;
+
+    std::shared_ptr<Reactor> _reactor;
+    int _sock = -1;
+    uint32_t _events = 0;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+
+    std::deque<std::shared_ptr<const buffer_t>> _send_queue;
+    size_t _send_offset = 0;
+    bool _want_write = false;
+
+    // data nobody has asked for yet is in [_staged_begin, _staged_end).
+    std::unique_ptr<unsigned char[]> _staged;
+    size_t _staged_capacity = 0;
+    size_t _staged_begin = 0;
+    size_t _staged_end = 0;
+    unsigned char *_recv_buf = nullptr;
+    size_t _recv_rem = 0;
+    bool _eof = false;
+
+    // somebody polls _event for the current receive, and it was written.
+    int _event = -1;
+    mutable bool _event_wanted = false;
+    mutable bool _event_signaled = false;
+};
+
+#ifdef NCOMM_HAVE_URING
+
+class UringChannel;
+
+// A single io_uring instance shared by all channels of a Network. Sockets are
+// registered as fixed files, and every channel gets a slice of one registered
+// buffer.
+//
+// Inside a batch, submissions are held back and reach the kernel together in
+// one io_uring_enter when the outermost batch ends or when somebody waits.
+//
+// Whoever waits reaps completions for everybody. While writes are in flight
+// and nobody waits, a thread of the ring's own does it, so queued writes keep
+// going when the sender is busy with something else.
+class Uring {
+public:
+
+    Uring(const size_t channels, const bool sqpoll);
+    ~Uring();
+
+    void begin_batch();
+    void end_batch();
+
+private:
+
+    friend class UringChannel;
+
+    // all called with _mutex held.
+    struct io_uring_sqe *get_sqe();
+    void submit();
+    void reap();
+    // cancel the operation with the given user_data.
+    void cancel(const uint64_t user_data);
+
+    void register_file(const size_t index, const int sock);
+    unsigned char *buffer(const size_t index) const;
+
+    // block until done() holds, reaping completions as they arrive. Called
+    // with lock held on _mutex.
+    void wait_for(std::unique_lock<std::mutex> &lock,
+		  const std::function<bool()> &done);
+
+    int enter(const unsigned to_submit, const unsigned min_complete,
+	      const unsigned flags);
+
+    void reaper_loop();
+
+    int _fd;
+    bool _sqpoll;
+
+    void *_sq_ptr;
+    size_t _sq_size;
+    void *_cq_ptr;
+    size_t _cq_size;
+    struct io_uring_sqe *_sqes;
+    size_t _sqes_size;
+
+    unsigned *_sq_head;
+    unsigned *_sq_tail;
+    unsigned *_sq_mask;
+    unsigned *_sq_flags;
+    unsigned *_sq_array;
+    unsigned _sq_entries;
+    unsigned _to_submit = 0;
+
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned *_cq_mask;
+    void *_cqes;
+
+    unsigned char *_buffers;
+    size_t _buffers_size;
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _waiting = false;
+    int _batch = 0;
+
+    std::thread _reaper;
+    size_t _sends_inflight = 0;
+    bool _stopping = false;
+};
+
+// A TCP channel whose reads and writes go through a shared Uring.
+//
+// At most one write and one read are in flight per socket, so data can never
+// be reordered. Writes small enough to fit are copied into the registered
+// buffer; larger ones are sent straight from the queued buffers.
+class UringChannel : public SocketChannel {
+public:
+
+    UringChannel(const channel_info_t info, std::shared_ptr<Uring> ring,
+		 const size_t index)
+	: SocketChannel{info},
+	  _ring{ring},
+	  _index{index}
+	{};
+
+    ~UringChannel() {
+	close();
+    };
+
+    void attach(const int sock);
+    void close();
+
+    using Channel::send;
+    void send(std::shared_ptr<const buffer_t> buf);
+    void send(std::shared_ptr<const buffer_t> header,
+	      std::shared_ptr<const buffer_t> payload);
+    void recv(std::vector<unsigned char> &buf);
+
+    void recv_start(std::vector<unsigned char> &buf) {
+	recv_start(buf.data(), buf.size());
+    };
+    void recv_start(unsigned char *data, const size_t size);
+    void recv_wait();
+    bool recv_test();
+
+    // an epoll set of the ring, which polls readable while completions wait
+    // to be reaped, and of an eventfd that is written once whoever reaps
+    // completes our receive.
+    int fd() const;
+
+private:
+
+    friend class Uring;
+
+    // peeks at the socket, like TCPChannel::recv_message().
+    size_t _peek(unsigned char *data, const size_t n, const size_t have);
+
+    // all called with the ring locked.
+    void send_queued();
+    void submit_send();
+    void submit_recv();
+    void complete(const bool is_send, const int res);
+
+    std::shared_ptr<Uring> _ring;
+    size_t _index;
+    int _sock = -1;
+
+    std::deque<std::shared_ptr<const buffer_t>> _send_queue;
+    size_t _send_offset = 0;
+    bool _send_inflight = false;
+    // bytes copied into the registered buffer and not yet written.
+    size_t _fixed_offset = 0;
+    size_t _fixed_length = 0;
+    std::vector<struct iovec> _iov;
+    struct msghdr _msg;
+
+    unsigned char *_recv_buf = nullptr;
+    size_t _recv_rem = 0;
+    bool _recv_inflight = false;
+    bool _eof = false;
+
+    int _event = -1;
+    int _poll = -1;
+    mutable bool _event_wanted = false;
+};
+
+#endif
+
+// A simulated link. Times are in seconds and bandwidth in bits per second,
+// where 0 means unlimited. Each message is delayed by latency plus a uniform
+// random amount of up to jitter, but never overtakes an earlier one.
+struct sim_link_t {
+    double latency = 0;
+    double bandwidth = 0;
+    double jitter = 0;
+};
+
+struct sim_pipe_t;
+
+// A channel between two threads of a SimNetwork. Nothing is actually delayed:
+// every message is stamped with the virtual time at which it would arrive,
+// and a receiver moves its party's clock forward to the arrival time of the
+// data it consumes. Time spent computing is not counted.
+class SimChannel : public Channel {
+public:
+
+    SimChannel(const channel_info_t info, const sim_link_t link,
+	       const uint64_t seed,
+	       std::shared_ptr<std::atomic<double>> clock,
+	       std::shared_ptr<sim_pipe_t> out,
+	       std::shared_ptr<sim_pipe_t> in);
+
+    ~SimChannel() {
+	close();
+    };
+
+    void connect() {
+	_alive = true;
+    };
+    void close();
+
+    using Channel::send;
+    void send(std::shared_ptr<const buffer_t> buf);
+    void recv(std::vector<unsigned char> &buf);
+
+private:
+
+    const sim_link_t _link;
+    std::mt19937_64 _rng;
+
+    // the virtual time of our party, shared by all its channels.
+    std::shared_ptr<std::atomic<double>> _clock;
+
+    // when the link is done transmitting what was sent so far, and when the
+    // last message arrives.
+    double _link_free = 0;
+    double _last_arrival = 0;
+
+    std::shared_ptr<sim_pipe_t> _out;
+    std::shared_ptr<sim_pipe_t> _in;
+};
+
+struct mux_t;
+
+// One of several logical channels over a single Channel, see Network::sub().
+// Each message goes out as a frame with a tag and a length, and the frames
+// that arrive are sorted into a queue per tag. There is no reader thread:
+// whoever needs data and finds none queued reads the next frame, while
+// receivers on other tags wait for it to hand them theirs. recv_test() reads
+// only as much of a frame as has arrived, and whoever reads next carries on
+// from there.
+class MuxChannel : public Channel {
+public:
+
+    MuxChannel(const channel_info_t info, std::shared_ptr<mux_t> mux,
+	       const uint32_t tag);
+
+    ~MuxChannel() {
+	close();
+    };
+
+    void connect() {
+	_alive = true;
+    };
+    void close();
+
+    using Channel::send;
+    void send(std::shared_ptr<const buffer_t> buf);
+    void recv(std::vector<unsigned char> &buf);
+
+    void recv_start(std::vector<unsigned char> &buf) {
+	recv_start(buf.data(), buf.size());
+    };
+    void recv_start(unsigned char *data, const size_t size);
+    void recv_wait();
+    bool recv_test();
+
+    // an epoll set of our own eventfd, which other receivers signal when they
+    // queue a frame or stop reading, and of the shared channel while nobody
+    // reads it. -1 if the shared channel has no descriptor.
+    int fd() const;
+
+    // the shared state of the sub-channels of chl.
+    static std::shared_ptr<mux_t> make_mux(Channel *chl);
+
+private:
+
+    std::shared_ptr<mux_t> _mux;
+    const uint32_t _tag;
+
+    unsigned char *_recv_buf = nullptr;
+    size_t _recv_rem = 0;
+
+    // see fd(). _polled is the shared descriptor in _poll, if any.
+    mutable int _event = -1;
+    mutable int _poll = -1;
+    mutable int _polled = -1;
+
+    // copies what is queued for us into the pending receive, with the lock
+    // held. True once the receive is complete.
+    bool _take();
+
+    // looks at what is queued for us, reading on if need be.
+    size_t _peek(unsigned char *data, const size_t n, const size_t have);
+};
+
+struct shm_ring_t;
+
+// A channel to a party on the same host. Each direction has a ring buffer in
+// shared memory that the sender copies into and the receiver copies out of;
+// the socket is only used to agree on the rings and to wake a receiver that
+// polls. Like TCPChannel, sends are queued and written by a thread of their
+// own.
+class ShmChannel : public SocketChannel {
+public:
+
+    using SocketChannel::SocketChannel;
+
+    ~ShmChannel() {
+	close();
+    };
+
+    void attach(const int sock);
+    void close();
+
+    using Channel::send;
+    void send(std::shared_ptr<const buffer_t> buf);
+    void send(std::shared_ptr<const buffer_t> header,
+	      std::shared_ptr<const buffer_t> payload);
+    void recv(std::vector<unsigned char> &buf);
+
+    void recv_start(std::vector<unsigned char> &buf) {
+	recv_start(buf.data(), buf.size());
+    };
+    void recv_start(unsigned char *data, const size_t size);
+    void recv_wait();
+    bool recv_test();
+
+    // an epoll set of the socket, which the writer sends a byte over when it
+    // writes to the ring while we poll, and of an eventfd for data that was
+    // there before.
+    int fd() const;
+
+private:
+
+    // looks at the ring without moving its head.
+    size_t _peek(unsigned char *data, const size_t n, const size_t have);
+
+    void _sender_loop();
+    void _write(const unsigned char *data, size_t size);
+
+    // copy what is available into the current receive. Returns false if
+    // it is incomplete and block is not set.
+    bool _read(const bool block);
+
+    SPSCQueue<std::shared_ptr<const buffer_t>> _send_queue;
+    std::thread _sender;
+
+    int _sock = -1;
+    shm_ring_t *_out = nullptr;
+    shm_ring_t *_in = nullptr;
+
+    int _event = -1;
+    int _poll = -1;
+
+    unsigned char *_recv_buf = nullptr;
+    size_t _recv_rem = 0;
+};
+
+// Listens on a single port for connections from peers. A client announces its
+// party ID in a small hello frame right after connecting, which is how
+// accepted connections are told apart.
+class TCPListener {
+public:
+
+    TCPListener(const int port, const int backlog);
+    // listen on a Unix socket instead.
+    TCPListener(const std::string &path, const int backlog);
+
+    ~TCPListener() {
+	close();
+    };
+
+    // accept the next peer. Returns the connected socket and stores the ID the
+    // peer announced in remote_id.
+    int accept(partyid_t &remote_id);
+    void close();
+
+    static void send_hello(const int sock, const partyid_t local_id);
+
+private:
+
+    int _sock;
+    std::string _path;
 };
 
 typedef struct {
@@ -255,11 +1644,91 @@ typedef struct {
 
 } network_info_t;
 
+// how a Network drives its TCP channels.
+enum io_engine {
+    THREADED,   // a sender thread per channel, receives on the caller's thread
+    EPOLL,      // a few reactor threads own all sockets
+    URING       // one io_uring for all sockets. THREADED if unavailable.
+};
+
+class Uring;
+class SimNetwork;
+#ifdef NCOMM_HAVE_COROUTINES
+class Task;
+#endif
+
+// Reduction kernels: acc[i] = acc[i] op x[i] for count elements.
+void reduce_xor(unsigned char *acc, const unsigned char *x, size_t count);
+// (acc[i] + x[i]) & mask
+void reduce_add(uint32_t *acc, const uint32_t *x, size_t count, uint32_t mask);
+void reduce_add(uint64_t *acc, const uint64_t *x, size_t count, uint64_t mask);
+// (acc[i] + x[i]) mod p. p must be below 2^63 and all inputs below p.
+void reduce_add_mod(uint64_t *acc, const uint64_t *x, size_t count, uint64_t p);
+
+// Reduction operators for Network::allreduce(). An operator names the type
+// of the elements and reduces a range of them into another.
+struct xor_op {
+    typedef unsigned char value_type;
+
+    void operator()(value_type *acc, const value_type *x, size_t count) const {
+	reduce_xor(acc, x, count);
+    };
+};
+
+// addition mod 2^bits, where T is uint32_t or uint64_t.
+template <typename T>
+struct add_op {
+    typedef T value_type;
+
+    add_op(const unsigned bits = 8 * sizeof(T))
+	: mask{bits >= 8 * sizeof(T) ? ~(T)0 : ((T)1 << bits) - 1}
+	{};
+
+    void operator()(value_type *acc, const value_type *x, size_t count) const {
+	reduce_add(acc, x, count, mask);
+    };
+
+    T mask;
+};
+
+// addition mod a prime (or any modulus) below 2^63.
+struct add_mod_op {
+    typedef uint64_t value_type;
+
+    explicit add_mod_op(const uint64_t p)
+	: p{p}
+	{};
+
+    void operator()(value_type *acc, const value_type *x, size_t count) const {
+	reduce_add_mod(acc, x, count, p);
+    };
+
+    uint64_t p;
+};
+
+struct network_stats_t {
+    uint64_t rounds = 0;
+    std::vector<channel_stats_t> channels;
+    channel_stats_t total;
+};
+
 enum exchange_order {
     INCREASING,
     DECREASING
 };
 
+// how a broadcast gets from the broadcaster to everyone else. All parties
+// must use the same algorithm for a given broadcast.
+enum broadcast_algorithm {
+    FLAT,       // the broadcaster sends to every peer itself
+    TREE,       // along a binomial tree, log n hops
+    PIPELINE    // in chunks along a chain, each party forwarding to the next
+};
+
+// the ranks rank sends to in a TREE broadcast to n parties, where the
+// broadcaster has rank 0.
+std::vector<size_t> tree_children(const size_t rank, const size_t n);
+
 class Network {
 public:
 
@@ -276,6 +1745,32 @@ public:
 	return _base_port;
     };
 
+    // must be set before connect().
+    io_engine& engine() {
+	return _engine;
+    };
+
+    size_t& reactor_threads() {
+	return _reactor_threads;
+    };
+
+    // record communication events and write them to this file as a Chrome
+    // trace when the network is closed. Must be set before connect().
+    std::string& trace_file() {
+	return _trace_file;
+    };
+
+    // talk to parties on this host through shared memory instead of the
+    // engine. Off by default. Must be the same on all parties.
+    bool& shm() {
+	return _shm;
+    };
+
+    // let a kernel thread poll the submission queue of the io_uring engine.
+    bool& uring_sqpoll() {
+	return _uring_sqpoll;
+    };
+
     std::size_t size() const {
 	return _info.size;
     };
@@ -292,10 +1787,74 @@ public:
 	const partyid_t receiver,
 	const std::vector<unsigned char> &buf) const;
 
+    void send_to(
+	const partyid_t receiver,
+	buffer_t &&buf) const;
+
+    void send_to(
+	const partyid_t receiver,
+	std::shared_ptr<const buffer_t> buf) const;
+
     void recv_from(
 	const partyid_t sender,
 	std::vector<unsigned char> &buf) const;
 
+    // see Channel::send_async() and Channel::recv_async().
+    Completion send_async(
+	const partyid_t receiver,
+	const std::vector<unsigned char> &buf) const;
+
+    Completion send_async(
+	const partyid_t receiver,
+	buffer_t &&buf) const;
+
+    Completion recv_async(
+	const partyid_t sender,
+	std::vector<unsigned char> &buf) const;
+
+    // framed messages, see Channel::send_message().
+    void send_message_to(
+	const partyid_t receiver,
+	const std::vector<unsigned char> &buf) const;
+
+    void send_message_to(
+	const partyid_t receiver,
+	buffer_t &&buf) const;
+
+    void recv_message_from(
+	const partyid_t sender,
+	std::vector<unsigned char> &buf) const;
+
+#ifdef NCOMM_HAVE_COROUTINES
+    // For coroutines running on a Scheduler, e.g.
+    //
+    //   co_await nw.co_recv_from(p, buf);
+    //
+    // A channel has at most one receive going at a time, so coroutines that
+    // run at the same time should not receive from the same party of the
+    // same Network.
+    Completion co_send_to(
+	const partyid_t receiver,
+	const std::vector<unsigned char> &buf) const {
+	return send_async(receiver, buf);
+    };
+
+    Completion co_recv_from(
+	const partyid_t sender,
+	std::vector<unsigned char> &buf) const {
+	return recv_async(sender, buf);
+    };
+
+    Task co_exchange_all(
+	const std::vector<std::vector<unsigned char>> &sbufs,
+	std::vector<std::vector<unsigned char>> &rbufs) const;
+
+    Task co_broadcast_recv(
+	const partyid_t broadcaster,
+	std::vector<unsigned char> &buf,
+	broadcast_algorithm algorithm = FLAT) const;
+#endif
+
     void exchange_with(
 	const partyid_t other,
 	const std::vector<unsigned char> &sbuf,
@@ -305,18 +1864,116 @@ public:
 	const std::vector<std::vector<unsigned char>> &sbufs,
 	std::vector<std::vector<unsigned char>> &rbufs) const;
 
+    // all peers share a single copy of the buffer. The broadcaster calls
+    // broadcast_recv() as well, and with TREE and PIPELINE the other parties
+    // forward the data from within broadcast_recv().
     void broadcast_send(
-	const std::vector<unsigned char> &buf) const;
+	const std::vector<unsigned char> &buf,
+	broadcast_algorithm algorithm = FLAT) const;
+
+    void broadcast_send(
+	buffer_t &&buf,
+	broadcast_algorithm algorithm = FLAT) const;
+
+    void broadcast_send(
+	std::shared_ptr<const buffer_t> buf,
+	broadcast_algorithm algorithm = FLAT) const;
 
     void broadcast_recv(
 	const partyid_t broadcaster,
-	std::vector<unsigned char> &buf) const;
+	std::vector<unsigned char> &buf,
+	broadcast_algorithm algorithm = FLAT) const;
 
     void exchange_ring(
 	const std::vector<unsigned char> &sbuf,
 	std::vector<unsigned char> &rbuf,
 	exchange_order order = DECREASING) const;
 
+    // Passes the origin's buf hops links along the ring (all the way round if
+    // hops is 0), in chunks of NCOMM_RING_CHUNK bytes. Every party forwards
+    // a chunk as soon as it has it, so this takes about one transfer of buf
+    // plus hops transfers of a chunk, instead of hops transfers of buf.
+    //
+    // on_chunk (if set) is called on every chunk a party receives, with its
+    // distance from the origin and its offset in buf, and may change it (but
+    // not its size) before it is stored in buf and passed on. All parties
+    // pass a buf of the same size; parties further than hops away from the
+    // origin are left alone.
+    typedef std::function<void(size_t hop, size_t offset,
+			       std::vector<unsigned char> &chunk)> ring_chunk_fn;
+
+    void pipeline_ring(
+	const partyid_t origin,
+	std::vector<unsigned char> &buf,
+	const ring_chunk_fn &on_chunk = nullptr,
+	size_t hops = 0,
+	exchange_order order = INCREASING) const;
+
+    // everyone's sbuf, in order of party ID. All parties send the same number
+    // of bytes and rbuf is resized to size() times that.
+    void allgather(
+	const std::vector<unsigned char> &sbuf,
+	std::vector<unsigned char> &rbuf) const;
+
+    // the reduction of everyone's sbuf under op, element by element, e.g.
+    //
+    //   nw.allreduce(share, value, add_op<uint64_t>());
+    //
+    // sbuf holds elements of Op::value_type and is the same size on all
+    // parties. rbuf is resized to match.
+    template <typename Op>
+    void allreduce(
+	const std::vector<unsigned char> &sbuf,
+	std::vector<unsigned char> &rbuf,
+	const Op &op = Op()) const;
+
+    // The following split one contiguous buffer into size() slices, slice i
+    // being [offsets[i], offsets[i + 1]). All parties pass the same offsets.
+    // Transfers to and from all peers happen at the same time.
+
+    // party i gets slice i of the dealer's sbuf in rbuf. sbuf is only read
+    // on the dealer.
+    void scatter(
+	const partyid_t dealer,
+	const std::vector<unsigned char> &sbuf,
+	const std::vector<size_t> &offsets,
+	std::vector<unsigned char> &rbuf) const;
+
+    // the collector gets party i's sbuf as slice i of rbuf. rbuf is only
+    // written on the collector.
+    void gather(
+	const partyid_t collector,
+	const std::vector<unsigned char> &sbuf,
+	const std::vector<size_t> &offsets,
+	std::vector<unsigned char> &rbuf) const;
+
+    // party i gets the reduction under op of slice i of everyone's sbuf.
+    // Offsets must be multiples of the size of Op::value_type.
+    template <typename Op>
+    void reduce_scatter(
+	const std::vector<unsigned char> &sbuf,
+	const std::vector<size_t> &offsets,
+	std::vector<unsigned char> &rbuf,
+	const Op &op = Op()) const;
+
+    // A network over the same connections, whose messages are kept apart
+    // from those of every other tag. Sub-networks of different tags can be
+    // used from different threads at the same time. They are created on
+    // first use and closed with this network, which must not send or receive
+    // on its own once they are in use.
+    Network& sub(const uint32_t tag);
+
+    // counters of all channels, per peer and summed up, and the number of
+    // communication rounds: one per exchange_* call, and one per broadcast
+    // (counted by broadcast_recv(), which the broadcaster calls as well).
+    network_stats_t stats() const;
+    void reset_stats();
+
+    // the histograms of all channels that keep them (see NCOMM_HISTOGRAMS),
+    // as text or as a JSON object.
+    std::string histograms_text() const;
+    std::string histograms_json() const;
+
     partyid_t ident_of_next() const {
 	return id() == size() - 1 ? 0 : id() + 1;
     };
@@ -339,12 +1996,477 @@ public:
 
 private:
 
+    friend class SimNetwork;
+
+    // a network over channels that are already set up.
+    Network(const network_info_t &info, const std::vector<Channel*> &peers)
+	: _info{info},
+	  _peers{peers}
+	{};
+
     network_info_t _info;
     std::vector<Channel*> _peers;
 
+    std::mutex _subs_mutex;
+    std::vector<std::shared_ptr<mux_t>> _muxes;
+    std::map<uint32_t, std::unique_ptr<Network>> _subs;
+
+    mutable std::atomic<uint64_t> _rounds {0};
+
+    void count_round() const {
+	_rounds.fetch_add(1, std::memory_order_relaxed);
+    };
+
     channel_info_t make_info(const partyid_t id, const std::string hostname) const;
 
     int _base_port = 5000;
+
+    io_engine _engine = THREADED;
+    size_t _reactor_threads = 1;
+    std::vector<std::shared_ptr<Reactor>> _reactors;
+    bool _uring_sqpoll = false;
+    bool _shm = false;
+    std::string _trace_file;
+    uint32_t _trace_session = 0;
+    std::shared_ptr<Uring> _uring;
+
+    // lets the io_uring engine submit a whole round at once.
+    void begin_batch() const;
+    void end_batch() const;
+
+    // complete receives that were started on the channels of senders, in
+    // whatever order the data arrives.
+    void wait_all(const std::vector<partyid_t> &senders) const;
+
+    typedef std::function<void(unsigned char *acc, const unsigned char *x,
+			       size_t bytes)> reducer_t;
+
+    void _allreduce(const std::vector<unsigned char> &sbuf,
+		    std::vector<unsigned char> &rbuf,
+		    const size_t width,
+		    const reducer_t &reduce) const;
+
+    void _reduce_scatter(const std::vector<unsigned char> &sbuf,
+			 const std::vector<size_t> &offsets,
+			 std::vector<unsigned char> &rbuf,
+			 const reducer_t &reduce) const;
+
+    // the ring algorithms, over blocks [offsets[b], offsets[b + 1]) of data.
+    void ring_allgather(unsigned char *data, const std::vector<size_t> &offsets,
+			const size_t first) const;
+    void ring_reduce_scatter(unsigned char *data, const std::vector<size_t> &offsets,
+			     const reducer_t &reduce) const;
+};
+
+template <typename Op>
+void Network::allreduce(const std::vector<unsigned char> &sbuf,
+			std::vector<unsigned char> &rbuf,
+			const Op &op) const
+{
+    typedef typename Op::value_type T;
+    assert (sbuf.size() % sizeof(T) == 0);
+
+    _allreduce(sbuf, rbuf, sizeof(T), [&op](unsigned char *acc, const unsigned char *x,
+					    size_t bytes) {
+	op((T *)acc, (const T *)x, bytes / sizeof(T));
+    });
+}
+
+template <typename Op>
+void Network::reduce_scatter(const std::vector<unsigned char> &sbuf,
+			     const std::vector<size_t> &offsets,
+			     std::vector<unsigned char> &rbuf,
+			     const Op &op) const
+{
+    typedef typename Op::value_type T;
+    assert (std::all_of(offsets.begin(), offsets.end(),
+			[](const size_t o) { return o % sizeof(T) == 0; }));
+
+    _reduce_scatter(sbuf, offsets, rbuf, [&op](unsigned char *acc, const unsigned char *x,
+					       size_t bytes) {
+	op((T *)acc, (const T *)x, bytes / sizeof(T));
+    });
+}
+
+#ifdef NCOMM_HAVE_COROUTINES
+
+// A coroutine that starts when it is first awaited or spawned on a
+// Scheduler. Awaiting it rethrows whatever it threw.
+class Task {
+public:
+
+    struct promise_type {
+	std::coroutine_handle<> continuation;
+	std::exception_ptr error;
+
+	Task get_return_object() {
+	    return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+	};
+
+	std::suspend_always initial_suspend() noexcept {
+	    return {};
+	};
+
+	// resume whoever awaited us, if anyone.
+	struct final_awaiter {
+	    bool await_ready() noexcept {
+		return false;
+	    };
+	    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+		auto c = h.promise().continuation;
+		return c ? c : std::noop_coroutine();
+	    };
+	    void await_resume() noexcept {};
+	};
+
+	final_awaiter final_suspend() noexcept {
+	    return {};
+	};
+
+	void return_void() {};
+
+	void unhandled_exception() {
+	    error = std::current_exception();
+	};
+    };
+
+    Task(Task &&other)
+	: _handle{other._handle}
+	{
+	    other._handle = nullptr;
+	};
+
+    Task(const Task&) = delete;
+
+    ~Task() {
+	if (_handle)
+	    _handle.destroy();
+    };
+
+    bool done() const {
+	return !_handle || _handle.done();
+    };
+
+    bool await_ready() const {
+	return done();
+    };
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+	_handle.promise().continuation = awaiting;
+	return _handle;
+    };
+
+    void await_resume() {
+	if (_handle.promise().error)
+	    std::rethrow_exception(_handle.promise().error);
+    };
+
+private:
+
+    friend class Scheduler;
+
+    Task(std::coroutine_handle<promise_type> handle)
+	: _handle{handle}
+	{};
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+// Runs any number of Tasks on the calling thread. A task that awaits a
+// Completion is put aside until it is done, and when no task can run the
+// scheduler sleeps in epoll_wait(). The epoll set holds the descriptor of
+// every pending receive, added when a task starts waiting and removed when
+// the receive completes, and an eventfd that completed sends write to. A
+// wakeup costs only the waiters that have something to say.
+//
+// It does not own the sockets like Reactor: every Network still has its own
+// connections and sender threads, so concurrent sessions are cheap only as
+// sub-networks of one Network (see Network::sub()). Receives of channels that
+// have no descriptor and cannot test without blocking (SimChannel) block the
+// whole scheduler until they are done.
+class Scheduler {
+public:
+
+    Scheduler()
+	: _event{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+	  _epoll{epoll_create1(EPOLL_CLOEXEC)}
+	{
+	    if (_event < 0 || _epoll < 0)
+		throw std::runtime_error("eventfd");
+	    control(EPOLL_CTL_ADD, _event, 0);
+	};
+
+    Scheduler(const Scheduler&) = delete;
+
+    ~Scheduler() {
+	for (auto &w : _sends)
+	    w.first.notify(-1);
+	::close(_epoll);
+	::close(_event);
+    };
+
+    void spawn(Task &&task) {
+	_ready.push_back(task._handle);
+	_tasks.push_back(std::move(task));
+    };
+
+    // until all tasks are done. Rethrows the first error of a task.
+    void run() {
+	Scheduler *outer = current();
+	current() = this;
+
+	std::vector<struct epoll_event> events (64);
+
+	while (!_ready.empty() || waiting()) {
+	    while (!_ready.empty()) {
+		auto h = _ready.front();
+		_ready.pop_front();
+		h.resume();
+	    }
+
+	    // these block until they are done, if need be.
+	    for (size_t i = 0; i < _unpolled.size(); ) {
+		if (_unpolled[i].first.test()) {
+		    _ready.push_back(_unpolled[i].second);
+		    _unpolled[i] = _unpolled.back();
+		    _unpolled.pop_back();
+		    continue;
+		}
+		i++;
+	    }
+
+	    if (!_ready.empty() || !waiting())
+		continue;
+
+	    int n = epoll_wait(_epoll, events.data(), events.size(),
+			       _unpolled.empty() ? -1 : 0);
+	    if (n < 0 && errno != EINTR)
+		throw std::runtime_error("epoll_wait");
+
+	    for (int i = 0; i < n; i++) {
+		const uint64_t key = events[i].data.u64;
+		if (key == 0)
+		    sends_done();
+		else
+		    recv_ready(key);
+	    }
+	}
+
+	current() = outer;
+
+	for (auto &t : _tasks)
+	    t.await_resume();
+	_tasks.clear();
+    };
+
+    // the scheduler running on this thread.
+    static Scheduler*& current() {
+	thread_local Scheduler *s = nullptr;
+	return s;
+    };
+
+    void wait(Completion c, std::coroutine_handle<> h) {
+	if (!c.is_recv()) {
+	    c.notify(_event);
+	    _sends.emplace_back(c, h);
+	    return;
+	}
+
+	const int fd = c.fd();
+	if (fd < 0) {
+	    _unpolled.emplace_back(c, h);
+	    return;
+	}
+
+	const uint64_t key = _next_key++;
+	control(EPOLL_CTL_ADD, fd, key);
+	_receives.emplace(key, receive_t{c, h, fd});
+    };
+
+private:
+
+    struct receive_t {
+	Completion c;
+	std::coroutine_handle<> h;
+	int fd;
+    };
+
+    void control(const int op, const int fd, const uint64_t key) {
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.u64 = key;
+	if (epoll_ctl(_epoll, op, fd, &ev) < 0)
+	    throw std::runtime_error("epoll_ctl");
+    };
+
+    bool waiting() const {
+	return !_sends.empty() || !_receives.empty() || !_unpolled.empty();
+    };
+
+    void sends_done() {
+	uint64_t count;
+	if (::read(_event, &count, sizeof(count)) < 0 && errno != EAGAIN)
+	    throw std::runtime_error("eventfd read");
+
+	for (size_t i = 0; i < _sends.size(); ) {
+	    if (_sends[i].first.test()) {
+		_sends[i].first.notify(-1);
+		_ready.push_back(_sends[i].second);
+		_sends[i] = _sends.back();
+		_sends.pop_back();
+		continue;
+	    }
+	    i++;
+	}
+    };
+
+    void recv_ready(const uint64_t key) {
+	auto it = _receives.find(key);
+	if (it == _receives.end())
+	    return;
+	auto &r = it->second;
+
+	if (r.c.test()) {
+	    epoll_ctl(_epoll, EPOLL_CTL_DEL, r.fd, nullptr);
+	    _ready.push_back(r.h);
+	    _receives.erase(it);
+	    return;
+	}
+
+	// some channels arm their descriptor in fd(), and it may change.
+	const int fd = r.c.fd();
+	if (fd == r.fd)
+	    return;
+	epoll_ctl(_epoll, EPOLL_CTL_DEL, r.fd, nullptr);
+	if (fd < 0) {
+	    _unpolled.emplace_back(r.c, r.h);
+	    _receives.erase(it);
+	    return;
+	}
+	control(EPOLL_CTL_ADD, fd, key);
+	r.fd = fd;
+    };
+
+    int _event;
+    int _epoll;
+
+    std::deque<std::coroutine_handle<>> _ready;
+    std::vector<std::pair<Completion, std::coroutine_handle<>>> _sends;
+    std::vector<std::pair<Completion, std::coroutine_handle<>>> _unpolled;
+    // by the key their descriptor is registered with. 0 is the eventfd.
+    std::map<uint64_t, receive_t> _receives;
+    uint64_t _next_key = 1;
+    std::vector<Task> _tasks;
+};
+
+inline auto operator co_await(Completion c)
+{
+    struct awaiter {
+	Completion c;
+
+	bool await_ready() {
+	    return c.test();
+	};
+	void await_suspend(std::coroutine_handle<> h) {
+	    assert (Scheduler::current());
+	    Scheduler::current()->wait(c, h);
+	};
+	void await_resume() {};
+    };
+
+    return awaiter{c};
+}
+
+inline Task Network::co_exchange_all(const std::vector<std::vector<unsigned char>> &sbufs,
+				     std::vector<std::vector<unsigned char>> &rbufs) const
+{
+    count_round();
+
+    // receives are awaited first, since our send to ourselves is only done
+    // once we have received it.
+    std::vector<Completion> pending;
+    for (partyid_t i = 0; i < size(); i++)
+	pending.push_back(recv_async(i, rbufs[i]));
+    for (partyid_t i = 0; i < size(); i++)
+	pending.push_back(send_async(i, sbufs[i]));
+
+    for (auto &c : pending)
+	co_await c;
+}
+
+inline Task Network::co_broadcast_recv(const partyid_t broadcaster,
+				       std::vector<unsigned char> &buf,
+				       broadcast_algorithm algorithm) const
+{
+    assert (broadcaster < size());
+    count_round();
+
+    if (algorithm == FLAT || broadcaster == id()) {
+	co_await recv_async(broadcaster, buf);
+	co_return;
+    }
+
+    // same schedules as broadcast_recv().
+    const size_t rank = (id() + size() - broadcaster) % size();
+    auto party = [this, broadcaster](const size_t r) {
+	return (partyid_t)((broadcaster + r) % this->size());
+    };
+
+    if (algorithm == TREE) {
+	co_await recv_async(party(rank & (rank - 1)), buf);
+	auto copy = std::make_shared<const buffer_t>(buf);
+	for (auto c : tree_children(rank, size()))
+	    send_to(party(c), copy);
+	co_return;
+    }
+
+    const bool last = rank == size() - 1;
+    for (size_t offset = 0; offset < buf.size(); offset += NCOMM_BROADCAST_CHUNK) {
+	buffer_t chunk (std::min((size_t)NCOMM_BROADCAST_CHUNK, buf.size() - offset));
+	co_await recv_async(party(rank - 1), chunk);
+	std::copy(chunk.begin(), chunk.end(), buf.begin() + offset);
+	if (!last)
+	    send_to(party(rank + 1), std::move(chunk));
+    }
+}
+
+#endif // NCOMM_HAVE_COROUTINES
+
+// Runs n parties as threads of this process, connected by SimChannels. Each
+// party keeps a virtual clock, so a protocol can be timed on a slow network
+// in a fraction of the wall time it would take there.
+class SimNetwork {
+public:
+
+    SimNetwork(const size_t n, const sim_link_t link = sim_link_t(),
+	       const uint64_t seed = 0);
+
+    std::size_t size() const {
+	return _n;
+    };
+
+    // the link from one party to another. Change before run().
+    sim_link_t& link(const partyid_t from, const partyid_t to) {
+	return _links[from * _n + to];
+    };
+
+    // Calls party with the connected Network of each party, on a thread of
+    // its own. Returns the simulated time, in seconds, at which the last
+    // party finished. The networks are closed afterwards; party must not call
+    // connect() or close().
+    double run(const std::function<void(Network&)> &party);
+
+    // the simulated time at which a party finished the last run().
+    double time(const partyid_t id) const {
+	return _times[id];
+    };
+
+private:
+
+    std::size_t _n;
+    uint64_t _seed;
+    std::vector<sim_link_t> _links;
+    std::vector<double> _times;
 };
 
 } // ncomm
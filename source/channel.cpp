@@ -2,10 +2,18 @@
 
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <climits>
+#include <algorithm>
 #include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
 
 namespace ncomm {
 
@@ -14,6 +22,39 @@ using std::string;
 
 typedef unsigned char u8;
 
+channel_stats_t& channel_stats_t::operator+=(const channel_stats_t &other)
+{
+    bytes_sent += other.bytes_sent;
+    messages_sent += other.messages_sent;
+    bytes_received += other.bytes_received;
+    messages_received += other.messages_received;
+    recv_seconds += other.recv_seconds;
+    send_queue_high_water = std::max(send_queue_high_water, other.send_queue_high_water);
+    return *this;
+}
+
+channel_stats_t Channel::stats() const
+{
+    channel_stats_t s;
+    s.bytes_sent = _counters.bytes_sent.load(std::memory_order_relaxed);
+    s.messages_sent = _counters.messages_sent.load(std::memory_order_relaxed);
+    s.bytes_received = _counters.bytes_received.load(std::memory_order_relaxed);
+    s.messages_received = _counters.messages_received.load(std::memory_order_relaxed);
+    s.recv_seconds = _counters.recv_nanoseconds.load(std::memory_order_relaxed) / 1e9;
+    s.send_queue_high_water = _counters.send_queue_high_water.load(std::memory_order_relaxed);
+    return s;
+}
+
+void Channel::reset_stats()
+{
+    _counters.bytes_sent.store(0, std::memory_order_relaxed);
+    _counters.messages_sent.store(0, std::memory_order_relaxed);
+    _counters.bytes_received.store(0, std::memory_order_relaxed);
+    _counters.messages_received.store(0, std::memory_order_relaxed);
+    _counters.recv_nanoseconds.store(0, std::memory_order_relaxed);
+    _counters.send_queue_high_water.store(0, std::memory_order_relaxed);
+}
+
 string channel_info_t::to_string() const
 {
     std::stringstream ss;
@@ -38,165 +79,708 @@ channel_info_t DummyChannel::generate_info(const partyid_t id)
 	.remote_id = id,
 	.port = -1,
 	.hostname = "",
-	.role = DUMMY
+	.role = DUMMY,
+	.local = false
     };
 
     return info;
 }
 
 void DummyChannel::send(const vector<unsigned char> &buf) {
-    _buffer = buf;
+    _count_send(buf.size(), _queue.size() + 1);
+    _queue.push_back({buf, nullptr});
+};
+
+void DummyChannel::send(buffer_t &&buf) {
+    _count_send(buf.size(), _queue.size() + 1);
+    _queue.push_back({std::move(buf), nullptr});
+};
+
+void DummyChannel::send(std::shared_ptr<const buffer_t> buf) {
+    _count_send(buf->size(), _queue.size() + 1);
+    _queue.push_back({buffer_t(), std::move(buf)});
 };
 
 void DummyChannel::recv(vector<unsigned char> &buf) {
     NCOMM_DEBUG("recv %s", to_string().c_str());
-    buf = _buffer;
+
+    if (_queue.empty())
+	throw std::runtime_error("recv on self without a send");
+
+    auto &msg = _queue.front();
+    if (msg.shared)
+	buf = *msg.shared;
+    else
+	buf = std::move(msg.owned);
+    _queue.pop_front();
+
+    _recv_begin(buf.size());
+    _recv_done();
 };
 
-void TCPChannel::connect_as_server()
+// LEB128: seven bits at a time, least significant first, with the high bit
+// set on all but the last byte.
+static const size_t varint_max = 10;
+
+static size_t varint_encode(uint64_t x, u8 *out)
+{
+    size_t n = 0;
+    while (x >= 0x80) {
+	out[n++] = (u8)x | 0x80;
+	x >>= 7;
+    }
+    out[n++] = (u8)x;
+    return n;
+}
+
+void Channel::send_message(std::shared_ptr<const buffer_t> buf)
+{
+    u8 header[varint_max];
+    const size_t n = varint_encode(buf->size(), header);
+    send(std::make_shared<buffer_t>(header, header + n), std::move(buf));
+}
+
+// the length of the header at the start of data and the size it holds, or 0
+// if the header does not end within data.
+static size_t varint_decode(const u8 *data, const size_t n, uint64_t &x)
+{
+    x = 0;
+    for (size_t i = 0; i < std::min(n, varint_max); i++) {
+	x |= (uint64_t)(data[i] & 0x7f) << (7 * i);
+	if (!(data[i] & 0x80))
+	    return i + 1;
+    }
+
+    if (n >= varint_max)
+	throw std::runtime_error("bad message header");
+    return 0;
+}
+
+void Channel::recv_message(vector<u8> &buf)
+{
+    // Header and payload make up one message.
+    _frame_begin();
+
+    try {
+	// look for the whole header in what has arrived, so that taking it
+	// is a single receive. Channels that cannot look ahead read it a byte
+	// at a time.
+	vector<u8> header (varint_max);
+	uint64_t size;
+	size_t length = 0;
+	for (size_t n = 0; length == 0 && (n = _peek(header.data(), varint_max, n)) > 0; )
+	    length = varint_decode(header.data(), n, size);
+
+	if (length > 0) {
+	    header.resize(length);
+	    recv(header);
+	} else {
+	    header.clear();
+	    do {
+		vector<u8> b (1);
+		recv(b);
+		header.push_back(b[0]);
+	    } while (varint_decode(header.data(), header.size(), size) == 0);
+	}
+
+	buf.resize(size);
+	recv(buf);
+    } catch (...) {
+	_frame_done();
+	throw;
+    }
+
+    _frame_done();
+}
+
+Completion Channel::send_async(buffer_t &&buf)
+{
+    // the channel lets go of the buffer once it has been written, and that is
+    // when the send is complete.
+    auto state = std::make_shared<completion_state_t>();
+    std::shared_ptr<const buffer_t> p (new buffer_t(std::move(buf)), [state](const buffer_t *b) {
+	delete b;
+	{
+	    // under the lock, so the eventfd cannot go away while we write.
+	    std::unique_lock<std::mutex> lock(state->mutex);
+	    state->done.store(1, std::memory_order_release);
+	    if (state->notify >= 0) {
+		const uint64_t one = 1;
+		if (::write(state->notify, &one, sizeof(one)) < 0)
+		    NCOMM_DEBUG("eventfd write: %s", strerror(errno));
+	    }
+	}
+	futex_wake(state->done);
+    });
+    send(std::move(p));
+    return Completion(state);
+}
+
+Completion Channel::recv_async(vector<u8> &buf)
+{
+    auto state = std::make_shared<completion_state_t>();
+    state->recv = this;
+    recv_start(buf);
+    return Completion(state);
+}
+
+bool Completion::test()
+{
+    if (!_state || _state->done.load(std::memory_order_acquire))
+	return true;
+
+    if (_state->recv && _state->recv->recv_test()) {
+	_state->recv->recv_wait();
+	_state->done.store(1, std::memory_order_release);
+	return true;
+    }
+
+    return false;
+}
+
+void Completion::wait()
+{
+    if (!_state)
+	return;
+
+    if (_state->recv) {
+	if (!_state->done.load(std::memory_order_acquire))
+	    _state->recv->recv_wait();
+	_state->done.store(1, std::memory_order_release);
+	return;
+    }
+
+    while (!_state->done.load(std::memory_order_acquire))
+	futex_wait(_state->done, 0);
+}
+
+int Completion::fd() const
+{
+    return _state && _state->recv ? _state->recv->fd() : -1;
+}
+
+void Completion::notify(const int efd)
+{
+    if (!_state || _state->recv)
+	return;
+
+    std::unique_lock<std::mutex> lock(_state->mutex);
+    if (efd >= 0 && _state->done.load(std::memory_order_acquire)) {
+	const uint64_t one = 1;
+	if (::write(efd, &one, sizeof(one)) < 0)
+	    throw std::runtime_error("eventfd write");
+	return;
+    }
+    _state->notify = efd;
+}
+
+void wait_all(vector<Completion> &handles)
+{
+    vector<Completion> pending (handles);
+    vector<struct pollfd> fds;
+
+    for (;;) {
+	pending.erase(std::remove_if(pending.begin(), pending.end(),
+				     [](Completion &c) { return c.test(); }),
+		      pending.end());
+
+	if (pending.empty())
+	    break;
+
+	// sends complete on their own, but a receive only moves while we
+	// drain it. So we may only block on a handle if no other receive is
+	// pending: otherwise our peers could be stuck writing to us while we
+	// wait, and we on them.
+	const size_t receives = std::count_if(pending.begin(), pending.end(),
+					      [](const Completion &c) {
+						  return c.is_recv();
+					      });
+	if (receives == 0) {
+	    pending.front().wait();
+	    pending.erase(pending.begin());
+	    continue;
+	}
+
+	auto last = std::find_if(pending.begin(), pending.end(),
+				 [](const Completion &c) { return c.is_recv(); });
+	if (receives == 1 && last->fd() < 0) {
+	    last->wait();
+	    pending.erase(last);
+	    continue;
+	}
+
+	// poll the receives that have a descriptor. Those that do not only
+	// make progress when tested, so with any of them around we cannot
+	// sleep.
+	bool spin = false;
+	fds.clear();
+	for (auto &c : pending) {
+	    if (!c.is_recv())
+		continue;
+	    if (c.fd() < 0)
+		spin = true;
+	    else
+		fds.push_back({c.fd(), POLLIN, 0});
+	}
+
+	if (poll(fds.data(), fds.size(), spin ? 0 : -1) < 0 && errno != EINTR)
+	    throw std::runtime_error("poll");
+	if (spin)
+	    std::this_thread::yield();
+    }
+}
+
+// hello frame: magic, party ID. Both in network byte order.
+static const uint32_t hello_magic = 0x6e636f6d;
+
+static const string unix_prefix = "unix:";
+
+bool is_unix_address(const string &address)
+{
+    return address.compare(0, unix_prefix.size(), unix_prefix) == 0;
+}
+
+string unix_socket_path(const string &address, const int port)
+{
+    return address.substr(unix_prefix.size()) + "/ncomm-" + std::to_string(port) + ".sock";
+}
+
+static struct sockaddr_un unix_sockaddr(const string &path)
+{
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+	throw std::runtime_error("unix socket path too long");
+    strcpy(addr.sun_path, path.c_str());
+    return addr;
+}
+
+TCPListener::TCPListener(const int port, const int backlog)
 {
     int opt = 1;
-    int ssock = socket(AF_INET, SOCK_STREAM, 0);
-    if (!ssock)
+    _sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (_sock < 0)
 	throw std::runtime_error("(server) socket");
 
-    if (setsockopt(ssock,
-		   SOL_SOCKET,
-		   SO_REUSEADDR | SO_REUSEPORT | TCP_NODELAY,
-		   &opt, sizeof(opt)))
-    {
+    // allow back-to-back runs to rebind while old connections are in
+    // TIME_WAIT.
+    if (setsockopt(_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
 	throw std::runtime_error("(server) setsockopt");
-    }
 
     struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(info().port);
+    addr.sin_port = htons(port);
 
-    if (bind(ssock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    if (bind(_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
 	throw std::runtime_error("(server) bind");
 
-    if (listen(ssock, 1) < 0)
+    if (listen(_sock, backlog) < 0)
 	throw std::runtime_error("(server) listen");
+}
 
-    auto addrlen = sizeof(addr);
-    _sock = accept(ssock, (struct sockaddr *)&addr, (socklen_t *)&addrlen);
-
+TCPListener::TCPListener(const string &path, const int backlog)
+{
+    _sock = socket(AF_UNIX, SOCK_STREAM, 0);
     if (_sock < 0)
-	throw std::runtime_error("(server) accept");
+	throw std::runtime_error("(server) socket");
+
+    auto addr = unix_sockaddr(path);
+
+    // a socket file left behind by an earlier run would make bind fail.
+    unlink(path.c_str());
+
+    if (bind(_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	throw std::runtime_error("(server) bind");
+    _path = path;
+
+    if (listen(_sock, backlog) < 0)
+	throw std::runtime_error("(server) listen");
+}
+
+void TCPListener::close()
+{
+    if (_sock >= 0)
+	::close(_sock);
+    _sock = -1;
+
+    if (!_path.empty())
+	unlink(_path.c_str());
+    _path.clear();
+}
+
+int TCPListener::accept(partyid_t &remote_id)
+{
+    for (;;) {
+	int sock = ::accept(_sock, nullptr, nullptr);
+	if (sock < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED)
+		continue;
+	    throw std::runtime_error("(server) accept");
+	}
+
+	uint32_t hello[2];
+	size_t offset = 0;
+	while (offset < sizeof(hello)) {
+	    ssize_t n = ::read(sock, (u8 *)hello + offset, sizeof(hello) - offset);
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    if (n <= 0)
+		break;
+	    offset += n;
+	}
+
+	if (offset == sizeof(hello) && ntohl(hello[0]) == hello_magic) {
+	    remote_id = ntohl(hello[1]);
+	    return sock;
+	}
+
+	// not one of ours, or it went away before saying hello.
+	NCOMM_DEBUG("dropping connection without hello");
+	::close(sock);
+    }
+}
+
+void TCPListener::send_hello(const int sock, const partyid_t local_id)
+{
+    const uint32_t hello[2] = {htonl(hello_magic), htonl(local_id)};
+    if (::send(sock, hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello))
+	throw std::runtime_error("(client) hello");
+}
+
+int SocketChannel::connect_as_server()
+{
+    std::unique_ptr<TCPListener> listener;
+    if (is_unix_address(info().hostname))
+	listener.reset(new TCPListener(unix_socket_path(info().hostname, info().port), 1));
+    else
+	listener.reset(new TCPListener(info().port, 1));
+
+    partyid_t remote_id;
+    int sock = listener->accept(remote_id);
+
+    if (remote_id != info().remote_id) {
+	::close(sock);
+	throw std::runtime_error("(server) unexpected peer");
+    }
 
     NCOMM_DEBUG("server connected");
-    _alive = true;
+    return sock;
 }
 
-void TCPChannel::connect_as_client()
+int SocketChannel::connect_as_client()
 {
-    _sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (_sock < 0)
-	throw std::runtime_error("(client) socket");
+    const bool is_unix = is_unix_address(info().hostname);
 
-    int opt = 1;
-    if (setsockopt(_sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)))
-    	throw std::runtime_error("(client) setsockopt");
+    struct sockaddr_storage storage = {};
+    socklen_t addr_len;
 
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(info().port);
+    if (is_unix) {
+	auto addr = unix_sockaddr(unix_socket_path(info().hostname, info().port));
+	memcpy(&storage, &addr, sizeof(addr));
+	addr_len = sizeof(addr);
+    } else {
+	auto addr = (struct sockaddr_in *)&storage;
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(info().port);
+	addr_len = sizeof(*addr);
 
-    if (inet_pton(AF_INET, info().hostname.c_str(), &addr.sin_addr) <= 0)
-	throw std::runtime_error("(client) inet_pton");
+	if (inet_pton(AF_INET, info().hostname.c_str(), &addr->sin_addr) <= 0)
+	    throw std::runtime_error("(client) inet_pton");
+    }
 
     int attempts = 0;
-    while (!is_alive()) {
-	if (::connect(_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    auto backoff = std::chrono::milliseconds(NCOMM_CONNECT_BACKOFF_MIN);
+
+    int sock;
+
+    for (;;) {
+	// the state of a socket is unspecified after a failed connect, so
+	// every attempt starts from a fresh one.
+	sock = socket(is_unix ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+	    throw std::runtime_error("(client) socket");
+
+	if (::connect(sock, (struct sockaddr *)&storage, addr_len) < 0) {
+	    ::close(sock);
 	    attempts += 1;
-	    sleep(1);
+	    std::this_thread::sleep_for(backoff);
+	    backoff = std::min(2 * backoff,
+			       std::chrono::milliseconds(NCOMM_CONNECT_BACKOFF_MAX));
 	} else {
-	    _alive = true;
 	    break;
 	}
     }
     NCOMM_DEBUG("connect in %d attempts", attempts);
+
+    TCPListener::send_hello(sock, info().local_id);
+    return sock;
 }
 
-void TCPChannel::connect()
+void SocketChannel::connect()
 {
     switch (info().role) {
     case channel_role::SERVER:
- 	connect_as_server();
+ 	attach(connect_as_server());
 	break;
     case channel_role::CLIENT:
-	connect_as_client();
+	attach(connect_as_client());
 	break;
     default:
-	throw std::runtime_error("TCPChannel with dummy role");
+	throw std::runtime_error("SocketChannel with dummy role");
     }
 
-    assert(is_alive());
+    NCOMM_DEBUG("conneted: %s", info().to_string().c_str());
+}
 
-    auto sender = [&]() {
-	while (this->_alive) {
-	    auto v = this->send_queue.front();
-	    this->_send(v.data(), v.size());
-	    this->send_queue.pop_front();
-	}
-    };
+void TCPChannel::attach(const int sock)
+{
+    int opt = 1;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)))
+	throw std::runtime_error("setsockopt");
 
-    std::thread s(sender);
-    s.detach();
+    _start(sock);
+}
 
-    NCOMM_DEBUG("conneted: %s", info().to_string().c_str());
+void TCPChannel::_start(const int sock)
+{
+    _sock = sock;
+    _alive = true;
+    _sender = std::thread(&TCPChannel::_sender_loop, this);
 }
 
 void TCPChannel::close()
 {
+    if (!is_alive())
+	return;
+
     _alive = false;
+
+    // flush whatever is still queued before tearing down the socket.
+    send_queue.close();
+    if (_sender.joinable())
+	_sender.join();
+
+    ::close(_sock);
 }
 
-void TCPChannel::send(const vector<u8>& buf)
+void TCPChannel::send(std::shared_ptr<const buffer_t> buf)
 {
-    send_queue.push_back(buf);
+    _count_send(buf->size(), send_queue.size() + 1);
+#ifdef NCOMM_HISTOGRAMS
+    _send_times.push_back(std::chrono::steady_clock::now());
+#endif
+    send_queue.push_back(std::move(buf));
 }
 
-void TCPChannel::_send(const u8 *buf, const size_t length)
+void TCPChannel::send(std::shared_ptr<const buffer_t> header,
+		      std::shared_ptr<const buffer_t> payload)
 {
-    size_t rem = length;
-    size_t offset = 0;
+    _count_send(header->size() + payload->size(), send_queue.size() + 1);
+#ifdef NCOMM_HISTOGRAMS
+    auto now = std::chrono::steady_clock::now(), again = now;
+    _send_times.push_back(std::move(now), std::move(again));
+#endif
+    send_queue.push_back(std::move(header), std::move(payload));
+}
 
-    // TODO: Error checking. Avoid looping forever if other end is dead.
-    while (rem > 0) {
-	ssize_t n = ::write(_sock, buf + offset, rem);
+void TCPChannel::_sender_loop()
+{
+    vector<struct iovec> iov (IOV_MAX);
+
+    // drain everything that is queued and write it with a single sendmsg.
+    while (send_queue.wait()) {
+	const size_t count = std::min((size_t)send_queue.available(), iov.size());
+	size_t bytes = 0;
+
+	for (size_t i = 0; i < count; i++) {
+	    auto &v = send_queue.at(i);
+	    iov[i].iov_base = (void *)v->data();
+	    iov[i].iov_len = v->size();
+	    bytes += v->size();
+	}
 
-	if (n < 0)
-	    continue;
+	{
+	    TraceScope trace(_trace_session, "write", remote_id(), bytes);
+	    const size_t calls = _send(iov.data(), count);
+	    if (calls < count)
+		_syscalls_saved.fetch_add(count - calls, std::memory_order_relaxed);
+	}
+
+#ifdef NCOMM_HISTOGRAMS
+	// times were queued before their messages, so there are enough.
+	const auto now = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < count; i++)
+	    _send_histogram.record(now - _send_times.at(i));
+	_send_times.pop_front(count);
+#endif
 
-	rem -= n;
-	offset += n;
+	send_queue.pop_front(count);
     }
+}
+
+size_t TCPChannel::_send(struct iovec *iov, int iovcnt)
+{
+    size_t calls = 0;
+
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+
+    for (;;) {
+	// skip what has been written completely.
+	while (msg.msg_iovlen > 0 && msg.msg_iov->iov_len == 0) {
+	    msg.msg_iov++;
+	    msg.msg_iovlen--;
+	}
+
+	if (msg.msg_iovlen == 0)
+	    break;
+
+	ssize_t n = ::sendmsg(_sock, &msg, MSG_NOSIGNAL);
+	calls++;
 
-    assert (rem == 0);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    // other end is gone. Nothing sensible to do but drop the data.
+	    NCOMM_DEBUG("send failed: %s", strerror(errno));
+	    break;
+	}
+
+	size_t rem = n;
+	while (rem > 0) {
+	    size_t k = std::min(rem, msg.msg_iov->iov_len);
+	    msg.msg_iov->iov_base = (u8 *)msg.msg_iov->iov_base + k;
+	    msg.msg_iov->iov_len -= k;
+	    rem -= k;
+	    if (msg.msg_iov->iov_len == 0) {
+		msg.msg_iov++;
+		msg.msg_iovlen--;
+	    }
+	}
+    }
+
+    return calls;
 }
 
 void TCPChannel::recv(vector<u8> &buf)
 {
     NCOMM_DEBUG("recv %s #bytes=%ld", to_string().c_str(), buf.size());
 
-    size_t rem = buf.size();
-    size_t offset = 0;
+    recv_start(buf);
+    recv_wait();
+}
+
+void TCPChannel::recv_message(vector<u8> &buf)
+{
+    NCOMM_DEBUG("recv_message %s", to_string().c_str());
+
+    u8 header[varint_max];
+    uint64_t size;
+    size_t length;
+    size_t want = 1;
+
+    // timed from here, like a receive that is started before its data is
+    // there.
+    _frame_begin();
+
+    // peek until the whole header is there. Asking for one byte more than
+    // last time blocks until it arrives.
+    for (;;) {
+	ssize_t n = ::recv(_sock, header, want, MSG_PEEK | MSG_WAITALL);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    throw std::runtime_error("connection closed");
 
-    // TODO: Error checking. Avoid looping forever if other end is dead.
-    while (rem > 0) {
-    	ssize_t n = ::read(_sock, buf.data() + offset, rem);
+	if ((length = varint_decode(header, n, size)) > 0)
+	    break;
+	want = n + 1;
+    }
 
-    	if (n < 0) {
-    	    continue;
-    	}
+    buf.resize(size);
+    _recv_begin(length + size);
 
-    	offset += n;
-    	rem -= n;
+    // then take header and payload with one read.
+    struct iovec iov[2] = {{header, length}, {buf.data(), buf.size()}};
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    while (msg.msg_iovlen > 0) {
+	ssize_t n = ::recvmsg(_sock, &msg, MSG_WAITALL);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    throw std::runtime_error("connection closed");
+
+	size_t rem = n;
+	while (msg.msg_iovlen > 0 && rem >= msg.msg_iov->iov_len) {
+	    rem -= msg.msg_iov->iov_len;
+	    msg.msg_iov++;
+	    msg.msg_iovlen--;
+	}
+	if (msg.msg_iovlen > 0) {
+	    msg.msg_iov->iov_base = (u8 *)msg.msg_iov->iov_base + rem;
+	    msg.msg_iov->iov_len -= rem;
+	}
+    }
+
+    _recv_record(_frame_done());
+}
+
+void TCPChannel::recv_start(u8 *data, const size_t size)
+{
+    _recv_buf = data;
+    _recv_rem = size;
+    _recv_begin(size);
+}
+
+bool TCPChannel::_recv_some(const int flags)
+{
+    ssize_t n = ::recv(_sock, _recv_buf, _recv_rem, flags);
+
+    if (n < 0) {
+	if (errno == EINTR)
+	    return true;
+	if (errno == EAGAIN || errno == EWOULDBLOCK)
+	    return false;
     }
 
-    assert (rem == 0);
+    if (n <= 0)
+	throw std::runtime_error("connection closed");
+
+    _recv_buf += n;
+    _recv_rem -= n;
+    return true;
+}
+
+void TCPChannel::_recv_record(const int64_t elapsed)
+{
+#ifdef NCOMM_HISTOGRAMS
+    if (elapsed >= 0)
+	_recv_histogram.record((uint64_t)elapsed);
+#else
+    (void)elapsed;
+#endif
+}
+
+void TCPChannel::recv_wait()
+{
+    while (_recv_rem > 0)
+	_recv_some(0);
+    _recv_record(_recv_done());
+}
+
+bool TCPChannel::recv_test()
+{
+    while (_recv_rem > 0) {
+	if (!_recv_some(MSG_DONTWAIT))
+	    return false;
+    }
+    _recv_record(_recv_done());
+    return true;
 }
 
 } // ncomm
@@ -0,0 +1,461 @@
+#include "../include/ncomm.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+namespace ncomm {
+
+using std::vector;
+
+typedef unsigned char u8;
+
+// how much a channel reads into its staging buffer at a time.
+static const size_t stage_chunk = 1 << 16;
+
+Reactor::Reactor()
+{
+    _epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epfd < 0)
+	throw std::runtime_error("epoll_create1");
+
+    _evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_evfd < 0)
+	throw std::runtime_error("eventfd");
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    if (epoll_ctl(_epfd, EPOLL_CTL_ADD, _evfd, &ev) < 0)
+	throw std::runtime_error("epoll_ctl");
+
+    _thread = std::thread(&Reactor::run, this);
+}
+
+Reactor::~Reactor()
+{
+    {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_running = false;
+    }
+    notify();
+    _thread.join();
+
+    ::close(_evfd);
+    ::close(_epfd);
+}
+
+void Reactor::notify()
+{
+    const uint64_t one = 1;
+    ssize_t n = ::write(_evfd, &one, sizeof(one));
+    (void)n;
+}
+
+void Reactor::control(EpollChannel *chl, const int sock,
+		      const uint32_t old_events, const uint32_t new_events)
+{
+    if (old_events == new_events)
+	return;
+
+    struct epoll_event ev = {};
+    ev.events = new_events;
+    ev.data.ptr = chl;
+
+    int op = EPOLL_CTL_MOD;
+    if (old_events == 0)
+	op = EPOLL_CTL_ADD;
+    else if (new_events == 0)
+	op = EPOLL_CTL_DEL;
+
+    if (epoll_ctl(_epfd, op, sock, &ev) < 0)
+	throw std::runtime_error("epoll_ctl");
+}
+
+void Reactor::remove(EpollChannel *chl, const int sock)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _removals.emplace_back(chl, sock);
+
+    // the removal is picked up by the next batch the reactor starts.
+    const uint64_t batch = _batches_started + 1;
+    notify();
+    _removed.wait(lock, [&]() { return _batches_done >= batch; });
+}
+
+void Reactor::run()
+{
+    vector<struct epoll_event> events (64);
+
+    for (;;) {
+	int n = epoll_wait(_epfd, events.data(), events.size(), -1);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    throw std::runtime_error("epoll_wait");
+	}
+
+	bool woken = false;
+	for (int i = 0; i < n; i++)
+	    woken = woken || events[i].data.ptr == nullptr;
+
+	// removals go first, so that events which are already in this batch
+	// are not delivered to channels that are being closed.
+	vector<std::pair<EpollChannel*, int>> removals;
+	uint64_t batch = 0;
+	bool running = true;
+
+	if (woken) {
+	    uint64_t x;
+	    ssize_t r = ::read(_evfd, &x, sizeof(x));
+	    (void)r;
+
+	    std::unique_lock<std::mutex> lock(_mutex);
+	    removals.swap(_removals);
+	    batch = ++_batches_started;
+	    running = _running;
+	}
+
+	for (auto &r : removals) {
+	    // the channel may have unregistered itself already.
+	    struct epoll_event ev = {};
+	    epoll_ctl(_epfd, EPOLL_CTL_DEL, r.second, &ev);
+	}
+
+	for (int i = 0; i < n; i++) {
+	    auto chl = (EpollChannel *)events[i].data.ptr;
+	    if (!chl)
+		continue;
+
+	    bool removed = false;
+	    for (auto &r : removals)
+		removed = removed || r.first == chl;
+
+	    if (!removed)
+		chl->on_event(events[i].events);
+	}
+
+	if (woken) {
+	    {
+		std::unique_lock<std::mutex> lock(_mutex);
+		_batches_done = batch;
+	    }
+	    _removed.notify_all();
+
+	    if (!running)
+		break;
+	}
+    }
+}
+
+void EpollChannel::attach(const int sock)
+{
+    _sock = sock;
+
+    int opt = 1;
+    if (setsockopt(_sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)))
+	throw std::runtime_error("setsockopt");
+
+    int flags = fcntl(_sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(_sock, F_SETFL, flags | O_NONBLOCK) < 0)
+	throw std::runtime_error("fcntl");
+
+    _event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_event < 0)
+	throw std::runtime_error("eventfd");
+
+    _alive = true;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    update_events();
+}
+
+void EpollChannel::close()
+{
+    if (!is_alive())
+	return;
+
+    {
+	// flush whatever is still queued.
+	std::unique_lock<std::mutex> lock(_mutex);
+	_cond.wait(lock, [this]() { return _send_queue.empty(); });
+    }
+
+    _reactor->remove(this, _sock);
+    ::close(_sock);
+    ::close(_event);
+    _alive = false;
+}
+
+void EpollChannel::update_events()
+{
+    // nothing more is read ahead once the staging buffer is full.
+    const bool room = _recv_rem > 0
+	|| _staged_end - _staged_begin < NCOMM_EPOLL_STAGE_SIZE;
+
+    uint32_t events = 0;
+    if (!_eof && room)
+	events |= EPOLLIN;
+    if (_want_write)
+	events |= EPOLLOUT;
+
+    _reactor->control(this, _sock, _events, events);
+    _events = events;
+}
+
+void EpollChannel::on_event(const uint32_t events)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+	const bool receiving = _recv_rem > 0;
+	fill();
+	if (receiving && (_recv_rem == 0 || _eof))
+	    signal();
+    }
+
+    if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+	flush();
+	if (_send_queue.empty())
+	    _want_write = false;
+    }
+
+    update_events();
+    _cond.notify_all();
+}
+
+void EpollChannel::send(std::shared_ptr<const buffer_t> buf)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _count_send(buf->size(), _send_queue.size() + 1);
+    _send_queue.emplace_back(std::move(buf));
+    send_queued();
+}
+
+void EpollChannel::send(std::shared_ptr<const buffer_t> header,
+			std::shared_ptr<const buffer_t> payload)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _count_send(header->size() + payload->size(), _send_queue.size() + 1);
+    _send_queue.emplace_back(std::move(header));
+    _send_queue.emplace_back(std::move(payload));
+    send_queued();
+}
+
+void EpollChannel::send_queued()
+{
+    // the reactor is already waiting to write what is queued before us.
+    if (_want_write)
+	return;
+
+    flush();
+
+    if (!_send_queue.empty()) {
+	_want_write = true;
+	update_events();
+    }
+}
+
+void EpollChannel::flush()
+{
+    struct iovec iov[IOV_MAX];
+
+    while (!_send_queue.empty()) {
+	size_t count = std::min(_send_queue.size(), (size_t)IOV_MAX);
+	for (size_t i = 0; i < count; i++) {
+	    auto &v = _send_queue[i];
+	    size_t offset = i == 0 ? _send_offset : 0;
+	    iov[i].iov_base = (void *)(v->data() + offset);
+	    iov[i].iov_len = v->size() - offset;
+	}
+
+	struct msghdr msg = {};
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+
+	ssize_t n = ::sendmsg(_sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return;
+	    // other end is gone. Nothing sensible to do but drop the data.
+	    NCOMM_DEBUG("send failed: %s", strerror(errno));
+	    _send_queue.clear();
+	    _send_offset = 0;
+	    return;
+	}
+
+	size_t rem = n;
+	while (!_send_queue.empty()) {
+	    size_t left = _send_queue.front()->size() - _send_offset;
+	    if (rem < left) {
+		_send_offset += rem;
+		break;
+	    }
+	    rem -= left;
+	    _send_offset = 0;
+	    _send_queue.pop_front();
+	}
+    }
+}
+
+void EpollChannel::fill()
+{
+    while (!_eof) {
+	ssize_t n;
+
+	if (_recv_rem > 0) {
+	    n = ::read(_sock, _recv_buf, _recv_rem);
+	    if (n > 0) {
+		_recv_buf += n;
+		_recv_rem -= n;
+	    }
+	} else {
+	    // nobody is waiting. Keep the data around until somebody is, and
+	    // move it to the front once most of the buffer has been consumed.
+	    if (_staged_begin > 0
+		&& (_staged_begin == _staged_end || _staged_begin > _staged_capacity / 2)) {
+		memmove(_staged.get(), _staged.get() + _staged_begin,
+			_staged_end - _staged_begin);
+		_staged_end -= _staged_begin;
+		_staged_begin = 0;
+	    }
+
+	    if (_staged_end == _staged_capacity) {
+		// full. update_events() stops watching the socket for now.
+		if (_staged_capacity >= NCOMM_EPOLL_STAGE_SIZE)
+		    return;
+		const size_t capacity = std::min(std::max(2 * _staged_capacity, stage_chunk),
+						 (size_t)NCOMM_EPOLL_STAGE_SIZE);
+		std::unique_ptr<u8[]> staged (new u8[capacity]);
+		memcpy(staged.get(), _staged.get(), _staged_end);
+		_staged = std::move(staged);
+		_staged_capacity = capacity;
+	    }
+
+	    n = ::read(_sock, _staged.get() + _staged_end, _staged_capacity - _staged_end);
+	    if (n > 0)
+		_staged_end += n;
+	}
+
+	if (n == 0) {
+	    _eof = true;
+	} else if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return;
+	    _eof = true;
+	}
+    }
+}
+
+void EpollChannel::recv(vector<u8> &buf)
+{
+    NCOMM_DEBUG("recv %s #bytes=%ld", to_string().c_str(), buf.size());
+
+    recv_start(buf);
+    recv_wait();
+}
+
+void EpollChannel::recv_start(u8 *data, const size_t size)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    size_t staged = std::min(_staged_end - _staged_begin, size);
+    std::copy_n(_staged.get() + _staged_begin, staged, data);
+    _staged_begin += staged;
+
+    _recv_buf = data + staged;
+    _recv_rem = size - staged;
+    _recv_begin(size);
+
+    _event_wanted = false;
+    if (_event_signaled) {
+	uint64_t x;
+	ssize_t r = ::read(_event, &x, sizeof(x));
+	(void)r;
+	_event_signaled = false;
+    }
+
+    // the reactor takes care of the rest, and reads ahead again if we made
+    // room in the staging buffer.
+    if (_recv_rem > 0)
+	fill();
+    update_events();
+}
+
+size_t EpollChannel::_peek(u8 *data, const size_t n, const size_t have)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // nothing is being received, so the reactor reads ahead for us.
+    _cond.wait(lock, [&]() { return _staged_end - _staged_begin > have || _eof; });
+
+    const size_t staged = std::min(_staged_end - _staged_begin, n);
+    if (staged <= have)
+	return 0;
+    std::copy_n(_staged.get() + _staged_begin, staged, data);
+    return staged;
+}
+
+bool EpollChannel::recv_test()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_recv_rem == 0)
+	_recv_done();
+    return _recv_rem == 0 || _eof;
+}
+
+void EpollChannel::signal() const
+{
+    if (!_event_wanted || _event_signaled)
+	return;
+
+    const uint64_t one = 1;
+    ssize_t n = ::write(_event, &one, sizeof(one));
+    (void)n;
+    _event_signaled = true;
+}
+
+int EpollChannel::fd() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // only receives somebody polls for pay for the eventfd, and one that is
+    // already complete must not leave them waiting.
+    _event_wanted = true;
+    if (_recv_rem == 0 || _eof)
+	signal();
+    return _event;
+}
+
+void EpollChannel::recv_wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _cond.wait(lock, [this]() { return _recv_rem == 0 || _eof; });
+
+    // fill() stops watching the socket once the peer hangs up.
+    update_events();
+
+    const bool complete = _recv_rem == 0;
+    _recv_buf = nullptr;
+    _recv_rem = 0;
+
+    if (!complete)
+	throw std::runtime_error("connection closed");
+    _recv_done();
+}
+
+} // ncomm
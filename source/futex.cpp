@@ -0,0 +1,25 @@
+#include "../include/ncomm.hpp"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+
+namespace ncomm {
+
+void futex_wait(std::atomic<uint32_t> &word, const uint32_t expected,
+		const bool shared)
+{
+    // EAGAIN (word already changed) and EINTR are both fine here; callers
+    // re-check their condition in a loop.
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+	    shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+void futex_wake(std::atomic<uint32_t> &word, const bool shared)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+	    shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+} // ncomm
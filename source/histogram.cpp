@@ -0,0 +1,120 @@
+#include "../include/ncomm.hpp"
+
+#include <cmath>
+
+namespace ncomm {
+
+Histogram::Histogram()
+{
+    for (auto &c : _counts)
+	c.store(0, std::memory_order_relaxed);
+}
+
+int Histogram::bucket(const uint64_t v)
+{
+    if (v < (1u << sub_bits))
+	return v;
+
+    const int shift = 63 - __builtin_clzll(v) - sub_bits;
+    return ((shift + 1) << sub_bits) + (int)((v >> shift) - (1u << sub_bits));
+}
+
+uint64_t Histogram::lower_bound(const int i)
+{
+    if (i < (1 << sub_bits))
+	return i;
+
+    const int group = i >> sub_bits;
+    const uint64_t sub = i & ((1 << sub_bits) - 1);
+    return ((1u << sub_bits) + sub) << (group - 1);
+}
+
+// only one thread records, so plain loads and stores will do.
+static inline void bump(std::atomic<uint64_t> &x, const uint64_t v)
+{
+    x.store(x.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+void Histogram::record(const uint64_t ns)
+{
+    bump(_counts[bucket(ns)], 1);
+    bump(_count, 1);
+    bump(_sum, ns);
+    if (ns > _max.load(std::memory_order_relaxed))
+	_max.store(ns, std::memory_order_relaxed);
+}
+
+void Histogram::reset()
+{
+    for (auto &c : _counts)
+	c.store(0, std::memory_order_relaxed);
+    _count.store(0, std::memory_order_relaxed);
+    _sum.store(0, std::memory_order_relaxed);
+    _max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::count() const
+{
+    return _count.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::max() const
+{
+    return _max.load(std::memory_order_relaxed);
+}
+
+double Histogram::mean() const
+{
+    const uint64_t n = count();
+    return n ? (double)_sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint64_t Histogram::quantile(const double q) const
+{
+    const uint64_t n = count();
+    if (n == 0)
+	return 0;
+
+    const uint64_t target = std::max((uint64_t)1, (uint64_t)std::ceil(q * n));
+    uint64_t seen = 0;
+    for (int i = 0; i < buckets; i++) {
+	seen += _counts[i].load(std::memory_order_relaxed);
+	if (seen >= target)
+	    return lower_bound(i);
+    }
+    return max();
+}
+
+std::string Histogram::to_string() const
+{
+    std::stringstream ss;
+    ss << "count=" << count() << " mean=" << (uint64_t)mean()
+       << " p50=" << quantile(0.5) << " p90=" << quantile(0.9)
+       << " p99=" << quantile(0.99) << " p999=" << quantile(0.999)
+       << " max=" << max() << " (ns)";
+    return ss.str();
+}
+
+std::string Histogram::to_json() const
+{
+    std::stringstream ss;
+    ss << "{\"count\":" << count() << ",\"mean\":" << (uint64_t)mean()
+       << ",\"p50\":" << quantile(0.5) << ",\"p90\":" << quantile(0.9)
+       << ",\"p99\":" << quantile(0.99) << ",\"p999\":" << quantile(0.999)
+       << ",\"max\":" << max() << ",\"buckets\":[";
+
+    // only the buckets that are in use, as [lower bound, count] pairs.
+    bool first = true;
+    for (int i = 0; i < buckets; i++) {
+	const uint64_t c = _counts[i].load(std::memory_order_relaxed);
+	if (c == 0)
+	    continue;
+	ss << (first ? "" : ",") << "[" << lower_bound(i) << "," << c << "]";
+	first = false;
+    }
+
+    ss << "]}";
+    return ss.str();
+}
+
+} // ncomm
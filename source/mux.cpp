@@ -0,0 +1,329 @@
+#include "../include/ncomm.hpp"
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <algorithm>
+
+namespace ncomm {
+
+using std::vector;
+
+typedef unsigned char u8;
+
+// frame header: tag and payload length, in network byte order.
+static const size_t header_size = 12;
+
+struct mux_chunk_t {
+    buffer_t data;
+    size_t offset;
+};
+
+struct mux_t {
+    Channel *channel;
+
+    // the channel's send queue takes one producer at a time.
+    std::mutex send_mutex;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::map<uint32_t, std::deque<mux_chunk_t>> queues;
+    bool reading = false;
+    std::exception_ptr error;
+
+    // eventfds of receivers polling fd(), by tag. Woken and forgotten
+    // whenever the reader queues a frame or stops reading.
+    std::map<uint32_t, int> waiting;
+
+    // the frame being read. Whoever reads next carries on with it.
+    enum { IDLE, HEADER, PAYLOAD } state = IDLE;
+    u8 header[header_size];
+    uint32_t tag;
+    buffer_t data;
+};
+
+static void signal(const int efd)
+{
+    const uint64_t one = 1;
+    ssize_t n = ::write(efd, &one, sizeof(one));
+    (void)n;
+}
+
+static void wake_waiting(mux_t &mux)
+{
+    for (auto &w : mux.waiting)
+	signal(w.second);
+    mux.waiting.clear();
+}
+
+static void start_frame(mux_t &mux)
+{
+    mux.channel->recv_start(mux.header, header_size);
+    mux.state = mux_t::HEADER;
+}
+
+// reads the rest of the current frame, or when block is false as much of it
+// as has arrived. True once the frame is complete. Only the reader calls it.
+static bool read_frame(mux_t &mux, const bool block)
+{
+    Channel *chl = mux.channel;
+
+    if (mux.state == mux_t::IDLE)
+	start_frame(mux);
+
+    if (mux.state == mux_t::HEADER) {
+	if (!block && !chl->recv_test())
+	    return false;
+	chl->recv_wait();
+
+	uint64_t size;
+	memcpy(&mux.tag, mux.header, 4);
+	memcpy(&size, mux.header + 4, 8);
+	mux.tag = ntohl(mux.tag);
+	mux.data.resize(be64toh(size));
+	if (mux.data.empty()) {
+	    mux.state = mux_t::IDLE;
+	    return true;
+	}
+	chl->recv_start(mux.data);
+	mux.state = mux_t::PAYLOAD;
+    }
+
+    if (!block && !chl->recv_test())
+	return false;
+    chl->recv_wait();
+    mux.state = mux_t::IDLE;
+    return true;
+}
+
+// reads on behalf of a receiver, queueing the frame once it is complete.
+// Called with the lock held and nobody else reading.
+static bool read_step(mux_t &mux, std::unique_lock<std::mutex> &lock, const bool block)
+{
+    mux.reading = true;
+    lock.unlock();
+
+    bool done;
+    try {
+	done = read_frame(mux, block);
+    } catch (...) {
+	lock.lock();
+	mux.error = std::current_exception();
+	mux.reading = false;
+	mux.cond.notify_all();
+	wake_waiting(mux);
+	throw;
+    }
+
+    lock.lock();
+    if (done && !mux.data.empty())
+	mux.queues[mux.tag].push_back({std::move(mux.data), 0});
+    mux.reading = false;
+    mux.cond.notify_all();
+    wake_waiting(mux);
+    return done;
+}
+
+std::shared_ptr<mux_t> MuxChannel::make_mux(Channel *chl)
+{
+    auto mux = std::make_shared<mux_t>();
+    mux->channel = chl;
+    return mux;
+}
+
+MuxChannel::MuxChannel(const channel_info_t info, std::shared_ptr<mux_t> mux,
+		       const uint32_t tag)
+    : Channel{info},
+      _mux{mux},
+      _tag{tag}
+{}
+
+void MuxChannel::send(std::shared_ptr<const buffer_t> buf)
+{
+    _count_send(buf->size(), 1);
+
+    auto header = std::make_shared<buffer_t>(header_size);
+    const uint32_t tag = htonl(_tag);
+    const uint64_t size = htobe64(buf->size());
+    memcpy(header->data(), &tag, 4);
+    memcpy(header->data() + 4, &size, 8);
+
+    std::unique_lock<std::mutex> lock(_mux->send_mutex);
+    _mux->channel->send(std::move(header), std::move(buf));
+}
+
+void MuxChannel::recv(vector<u8> &buf)
+{
+    recv_start(buf);
+    recv_wait();
+}
+
+void MuxChannel::recv_start(u8 *data, const size_t size)
+{
+    NCOMM_DEBUG("recv %s #bytes=%ld", to_string().c_str(), size);
+
+    _recv_buf = data;
+    _recv_rem = size;
+    _recv_begin(size);
+}
+
+bool MuxChannel::_take()
+{
+    auto &queue = _mux->queues[_tag];
+
+    while (_recv_rem > 0 && !queue.empty()) {
+	auto &c = queue.front();
+	const size_t n = std::min(c.data.size() - c.offset, _recv_rem);
+	std::copy_n(c.data.data() + c.offset, n, _recv_buf);
+	c.offset += n;
+	_recv_buf += n;
+	_recv_rem -= n;
+	if (c.offset == c.data.size())
+	    queue.pop_front();
+    }
+
+    return _recv_rem == 0;
+}
+
+size_t MuxChannel::_peek(u8 *data, const size_t n, const size_t have)
+{
+    std::unique_lock<std::mutex> lock(_mux->mutex);
+
+    for (;;) {
+	size_t count = 0;
+	for (auto &c : _mux->queues[_tag]) {
+	    const size_t k = std::min(c.data.size() - c.offset, n - count);
+	    std::copy_n(c.data.data() + c.offset, k, data + count);
+	    count += k;
+	    if (count == n)
+		break;
+	}
+	if (count > have)
+	    return count;
+
+	if (_mux->error)
+	    std::rethrow_exception(_mux->error);
+
+	if (_mux->reading)
+	    _mux->cond.wait(lock);
+	else
+	    read_step(*_mux, lock, true);
+    }
+}
+
+void MuxChannel::recv_wait()
+{
+    std::unique_lock<std::mutex> lock(_mux->mutex);
+
+    while (!_take()) {
+	if (_mux->error)
+	    std::rethrow_exception(_mux->error);
+
+	if (_mux->reading) {
+	    _mux->cond.wait(lock);
+	    continue;
+	}
+
+	// nobody is reading, so it is up to us.
+	read_step(*_mux, lock, true);
+    }
+
+    lock.unlock();
+    _recv_done();
+}
+
+bool MuxChannel::recv_test()
+{
+    std::unique_lock<std::mutex> lock(_mux->mutex);
+
+    while (!_take()) {
+	if (_mux->error)
+	    std::rethrow_exception(_mux->error);
+
+	// whoever is reading hands us our data, and wakes fd() when done.
+	if (_mux->reading || !read_step(*_mux, lock, false))
+	    return false;
+    }
+
+    lock.unlock();
+    _recv_done();
+    return true;
+}
+
+int MuxChannel::fd() const
+{
+    std::unique_lock<std::mutex> lock(_mux->mutex);
+
+    if (_event < 0) {
+	_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	_poll = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = _event;
+	if (_event < 0 || _poll < 0 || epoll_ctl(_poll, EPOLL_CTL_ADD, _event, &ev) < 0)
+	    throw std::runtime_error("MuxChannel::fd");
+    }
+
+    uint64_t count;
+    ssize_t n = ::read(_event, &count, sizeof(count));
+    (void)n;
+
+    auto it = _mux->queues.find(_tag);
+    if (_mux->error || (it != _mux->queues.end() && !it->second.empty())) {
+	signal(_event);
+	return _poll;
+    }
+
+    // whoever reads from now on may take our frame off the shared channel,
+    // so they have to wake us. While somebody reads, that is all we wait for.
+    _mux->waiting[_tag] = _event;
+
+    int shared = -1;
+    if (!_mux->reading) {
+	// the shared descriptor only means something with a receive going.
+	if (_mux->state == mux_t::IDLE)
+	    start_frame(*_mux);
+	shared = _mux->channel->fd();
+	if (shared < 0) {
+	    _mux->waiting.erase(_tag);
+	    return -1;
+	}
+    }
+
+    if (shared != _polled) {
+	if (_polled >= 0)
+	    epoll_ctl(_poll, EPOLL_CTL_DEL, _polled, nullptr);
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = shared;
+	if (shared >= 0 && epoll_ctl(_poll, EPOLL_CTL_ADD, shared, &ev) < 0)
+	    throw std::runtime_error("MuxChannel::fd");
+	_polled = shared;
+    }
+
+    return _poll;
+}
+
+void MuxChannel::close()
+{
+    _alive = false;
+
+    if (_event < 0)
+	return;
+
+    {
+	std::unique_lock<std::mutex> lock(_mux->mutex);
+	auto it = _mux->waiting.find(_tag);
+	if (it != _mux->waiting.end() && it->second == _event)
+	    _mux->waiting.erase(it);
+    }
+
+    ::close(_poll);
+    ::close(_event);
+    _poll = _event = _polled = -1;
+}
+
+} // ncomm
@@ -1,6 +1,15 @@
 #include "../include/ncomm.hpp"
 
 #include <thread>
+#include <fstream>
+#include <exception>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <algorithm>
+#include <netdb.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
 
 namespace ncomm {
 
@@ -46,10 +55,60 @@ Network::Network(const partyid_t id, const string network_info_filename)
 
 void Network::close()
 {
+    // sub-networks first, they use our channels.
+    for (auto &s : _subs)
+	s.second->close();
+    _subs.clear();
+    _muxes.clear();
+
     for (auto &peer : _peers) {
 	peer->close();
 	delete peer;
     }
+    _peers.clear();
+    _reactors.clear();
+    _uring.reset();
+
+    // sender threads have been joined, so their events are all in.
+    if (_trace_session) {
+	std::ofstream out (_trace_file);
+	out << trace_json(_trace_session, id());
+	trace_end_session(_trace_session);
+	_trace_session = 0;
+	if (!out)
+	    throw std::runtime_error("could not write " + _trace_file);
+    }
+}
+
+// true if hostname resolves to a loopback address or one of our interfaces.
+static bool is_local_host(const string &hostname)
+{
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+
+    struct addrinfo *addrs;
+    if (getaddrinfo(hostname.c_str(), nullptr, &hints, &addrs))
+	return false;
+
+    struct ifaddrs *ifs = nullptr;
+    if (getifaddrs(&ifs))
+	ifs = nullptr;
+
+    bool local = false;
+    for (auto a = addrs; a && !local; a = a->ai_next) {
+	auto addr = ((struct sockaddr_in *)a->ai_addr)->sin_addr;
+	local = (ntohl(addr.s_addr) >> 24) == 127;
+
+	for (auto i = ifs; i && !local; i = i->ifa_next) {
+	    if (i->ifa_addr && i->ifa_addr->sa_family == AF_INET)
+		local = ((struct sockaddr_in *)i->ifa_addr)->sin_addr.s_addr == addr.s_addr;
+	}
+    }
+
+    freeaddrinfo(addrs);
+    if (ifs)
+	freeifaddrs(ifs);
+    return local;
 }
 
 channel_info_t Network::make_info(const partyid_t remote_id, const string hostname) const
@@ -64,16 +123,21 @@ channel_info_t Network::make_info(const partyid_t remote_id, const string hostna
     else
 	cinfo.role = id() < remote_id ? channel_role::CLIENT : channel_role::SERVER;
 
+    // every party listens on a single port.
     if (cinfo.role == channel_role::CLIENT) {
-	auto offset = size() * id() + remote_id;
-	cinfo.port = _base_port + offset;
+	cinfo.port = _base_port + remote_id;
 	cinfo.hostname = hostname;
     } else {
-	auto offset = size() * remote_id + id();
-	cinfo.port = _base_port + offset;
-	cinfo.hostname = NCOMM_LOCALHOST_IP;
+	cinfo.port = _base_port + id();
+	if (is_unix_address(_info.addrs[id()]))
+	    cinfo.hostname = _info.addrs[id()];
+	else
+	    cinfo.hostname = NCOMM_LOCALHOST_IP;
     }
 
+    cinfo.local = cinfo.role != channel_role::DUMMY
+	&& is_local_host(hostname) && is_local_host(_info.addrs[id()]);
+
     return cinfo;
 }
 
@@ -81,99 +145,471 @@ void Network::connect()
 {
     NCOMM_DEBUG("%s connect()", info().to_string().c_str());
 
+    if (!_trace_file.empty() && !_trace_session)
+	_trace_session = trace_new_session();
+    TraceScope trace(_trace_session, "connect");
+
     _peers.resize(size());
 
+    if (_engine == io_engine::EPOLL) {
+	assert (_reactor_threads > 0);
+	for (size_t i = 0; i < _reactor_threads; i++)
+	    _reactors.emplace_back(std::make_shared<Reactor>());
+    }
+
+    if (_engine == io_engine::URING) {
+#ifdef NCOMM_HAVE_URING
+	try {
+	    _uring = std::make_shared<Uring>(size(), _uring_sqpoll);
+	} catch (std::runtime_error &e) {
+	    NCOMM_DEBUG("io_uring unavailable (%s), using threads", e.what());
+	    _engine = io_engine::THREADED;
+	}
+#else
+	_engine = io_engine::THREADED;
+#endif
+    }
+
     for (size_t i = 0; i < size(); i++) {
 
 	auto chl_info = make_info(i, _info.addrs[i]);
 
 	if (chl_info.role == channel_role::DUMMY)
 	    _peers[i] = new DummyChannel(i);
+	else if (chl_info.local && _shm)
+	    _peers[i] = new ShmChannel(chl_info);
+	else if (is_unix_address(chl_info.hostname))
+	    _peers[i] = new UnixChannel(chl_info);
+	else if (_engine == io_engine::EPOLL)
+	    _peers[i] = new EpollChannel(chl_info, _reactors[i % _reactors.size()]);
+#ifdef NCOMM_HAVE_URING
+	else if (_engine == io_engine::URING)
+	    _peers[i] = new UringChannel(chl_info, _uring, i);
+#endif
 	else
 	    _peers[i] = new TCPChannel(chl_info);
 
-	_peers[i]->connect();
+	// before connecting, since that starts the sender threads.
+	_peers[i]->trace_session() = _trace_session;
+    }
+
+    // connect all channels at the same time, so that waiting on a slow peer
+    // does not delay everyone else. Parties with a lower ID connect to us
+    // through a single listener and tell us who they are.
+    vector<std::thread> connectors;
+    vector<std::exception_ptr> errors (size());
+
+    std::unique_ptr<TCPListener> listener;
+    if (id() > 0 && is_unix_address(_info.addrs[id()]))
+	listener.reset(new TCPListener(unix_socket_path(_info.addrs[id()], _base_port + id()), id()));
+    else if (id() > 0)
+	listener.reset(new TCPListener(_base_port + id(), id()));
+
+    for (size_t i = 0; i < size(); i++) {
+	if (_peers[i]->info().role == channel_role::SERVER)
+	    continue;
+
+	connectors.emplace_back([this, i, &errors]() {
+	    TraceScope trace(_trace_session, "connect", i);
+	    try {
+		this->_peers[i]->connect();
+	    } catch (...) {
+		errors[i] = std::current_exception();
+	    }
+	});
+    }
+
+    try {
+	size_t accepted = 0;
+	while (accepted < id()) {
+	    partyid_t remote_id;
+	    int sock = listener->accept(remote_id);
+
+	    SocketChannel *chl = nullptr;
+	    if (remote_id < id())
+		chl = dynamic_cast<SocketChannel*>(_peers[remote_id]);
+
+	    if (!chl || chl->is_alive()) {
+		NCOMM_DEBUG("unexpected peer %u", remote_id);
+		::close(sock);
+		continue;
+	    }
+
+	    TraceScope trace(_trace_session, "accept", remote_id);
+	    chl->attach(sock);
+	    accepted++;
+	}
+    } catch (...) {
+	errors[id()] = std::current_exception();
+    }
+
+    for (auto &c : connectors)
+	c.join();
+
+    for (auto &e : errors) {
+	if (e)
+	    std::rethrow_exception(e);
     }
 }
 
+Network& Network::sub(const uint32_t tag)
+{
+    std::unique_lock<std::mutex> lock(_subs_mutex);
+
+    auto &s = _subs[tag];
+    if (s)
+	return *s;
+
+    if (_muxes.empty()) {
+	_muxes.resize(size());
+	for (size_t i = 0; i < size(); i++) {
+	    if (i != id())
+		_muxes[i] = MuxChannel::make_mux(_peers[i]);
+	}
+    }
+
+    vector<Channel*> peers (size());
+    for (size_t i = 0; i < size(); i++) {
+	if (i == id())
+	    peers[i] = new DummyChannel(id());
+	else
+	    peers[i] = new MuxChannel(_peers[i]->info(), _muxes[i], tag);
+	peers[i]->connect();
+    }
+
+    s.reset(new Network(_info, peers));
+    return *s;
+}
+
+network_stats_t Network::stats() const
+{
+    network_stats_t s;
+    s.rounds = _rounds.load(std::memory_order_relaxed);
+    for (auto &peer : _peers) {
+	s.channels.push_back(peer->stats());
+	s.total += s.channels.back();
+    }
+    return s;
+}
+
+void Network::reset_stats()
+{
+    _rounds.store(0, std::memory_order_relaxed);
+    for (auto &peer : _peers)
+	peer->reset_stats();
+}
+
+string Network::histograms_text() const
+{
+    std::stringstream ss;
+    for (size_t i = 0; i < _peers.size(); i++) {
+	auto send = _peers[i]->send_histogram();
+	auto recv = _peers[i]->recv_histogram();
+	if (send)
+	    ss << "party " << id() << " peer " << i << " send: " << send->to_string() << "\n";
+	if (recv)
+	    ss << "party " << id() << " peer " << i << " recv: " << recv->to_string() << "\n";
+    }
+    return ss.str();
+}
+
+string Network::histograms_json() const
+{
+    std::stringstream ss;
+    ss << "{\"party\":" << id() << ",\"channels\":[";
+
+    bool first = true;
+    for (size_t i = 0; i < _peers.size(); i++) {
+	auto send = _peers[i]->send_histogram();
+	auto recv = _peers[i]->recv_histogram();
+	if (!send && !recv)
+	    continue;
+
+	ss << (first ? "" : ",") << "{\"peer\":" << i;
+	if (send)
+	    ss << ",\"send\":" << send->to_json();
+	if (recv)
+	    ss << ",\"recv\":" << recv->to_json();
+	ss << "}";
+	first = false;
+    }
+
+    ss << "]}";
+    return ss.str();
+}
+
+void Network::begin_batch() const
+{
+#ifdef NCOMM_HAVE_URING
+    if (_uring)
+	_uring->begin_batch();
+#endif
+}
+
+void Network::end_batch() const
+{
+#ifdef NCOMM_HAVE_URING
+    if (_uring)
+	_uring->end_batch();
+#endif
+}
+
 void Network::send_to(const partyid_t receiver, const vector<u8> &buf) const
 {
+    TraceScope trace(_trace_session, "send_to", receiver, buf.size());
     assert (receiver < size());
     _peers[receiver]->send(buf);
 }
 
+void Network::send_to(const partyid_t receiver, buffer_t &&buf) const
+{
+    TraceScope trace(_trace_session, "send_to", receiver, buf.size());
+    assert (receiver < size());
+    _peers[receiver]->send(std::move(buf));
+}
+
+void Network::send_to(const partyid_t receiver, std::shared_ptr<const buffer_t> buf) const
+{
+    TraceScope trace(_trace_session, "send_to", receiver, buf->size());
+    assert (receiver < size());
+    _peers[receiver]->send(std::move(buf));
+}
+
 void Network::recv_from(const partyid_t sender, vector<u8> &buf) const
 {
+    TraceScope trace(_trace_session, "recv_from", sender, buf.size());
     assert (sender < size());
     _peers[sender]->recv(buf);
 }
 
-void Network::exchange_with(const partyid_t other, const vector<u8> &sbuf, vector<u8> &rbuf) const
+Completion Network::send_async(const partyid_t receiver, const vector<u8> &buf) const
 {
-    if (other == id()) {
-	// less efficient than need be, but more consistent behaviorwise
-	send_to(id(), sbuf);
-	recv_from(id(), rbuf);
-	return;
-    }
+    assert (receiver < size());
+    return _peers[receiver]->send_async(buf);
+}
 
-    auto one_shot = [&]() {
-	this->send_to((partyid_t)other, sbuf);
-    };
+Completion Network::send_async(const partyid_t receiver, buffer_t &&buf) const
+{
+    assert (receiver < size());
+    return _peers[receiver]->send_async(std::move(buf));
+}
 
-    std::thread sender (one_shot);
+Completion Network::recv_async(const partyid_t sender, vector<u8> &buf) const
+{
+    assert (sender < size());
+    return _peers[sender]->recv_async(buf);
+}
 
-    recv_from(other, rbuf);
+void Network::send_message_to(const partyid_t receiver, const vector<u8> &buf) const
+{
+    TraceScope trace(_trace_session, "send_message_to", receiver, buf.size());
+    assert (receiver < size());
+    _peers[receiver]->send_message(buf);
+}
+
+void Network::send_message_to(const partyid_t receiver, buffer_t &&buf) const
+{
+    TraceScope trace(_trace_session, "send_message_to", receiver, buf.size());
+    assert (receiver < size());
+    _peers[receiver]->send_message(std::move(buf));
+}
 
-    sender.join();
+void Network::recv_message_from(const partyid_t sender, vector<u8> &buf) const
+{
+    TraceScope trace(_trace_session, "recv_message_from", sender);
+    assert (sender < size());
+    _peers[sender]->recv_message(buf);
+}
+
+void Network::exchange_with(const partyid_t other, const vector<u8> &sbuf, vector<u8> &rbuf) const
+{
+    TraceScope trace(_trace_session, "exchange_with", other, sbuf.size());
+    // send() only queues the message, however much is queued already, so
+    // there is no need for a separate thread to avoid deadlocking with the
+    // other party.
+    count_round();
+    send_to(other, sbuf);
+    recv_from(other, rbuf);
 }
 
 void Network::exchange_all(const vector<vector<u8>> &sbufs, vector<vector<u8>> &rbufs) const
 {
     NCOMM_DEBUG("exchange_all()");
-
-    // auto handler = [&](){
-    // 	for (size_t i = 0; i < size(); i++) {
-    // 	    if (i == this->id())
-    // 		continue;
-    // 	    this->send_to((partyid_t)i, sbufs[i]);
-    // 	}
-    // };
+    TraceScope trace(_trace_session, "exchange_all", -1, sbufs[this->id()].size());
+    count_round();
 
     // we need to ensure that we "send" to ourselves before read is called.
     send_to(this->id(), sbufs[this->id()]);
 
+    begin_batch();
+
     for (size_t i = 0; i < size(); i++) {
 	if (i == this->id())
 	    continue;
 	this->send_to((partyid_t)i, sbufs[i]);
     }
 
-    // std::thread sender (handler);
+    vector<partyid_t> senders (size());
+    for (size_t i = 0; i < size(); i++) {
+	_peers[i]->recv_start(rbufs[i]);
+	senders[i] = i;
+    }
+
+    end_batch();
+
+    wait_all(senders);
+}
+
+void Network::wait_all(const vector<partyid_t> &senders) const
+{
+    vector<partyid_t> pending (senders);
+    vector<struct pollfd> fds;
+
+    for (;;) {
+	auto done = [this](const partyid_t p) {
+	    return this->_peers[p]->recv_test();
+	};
+	pending.erase(std::remove_if(pending.begin(), pending.end(), done),
+		      pending.end());
+
+	if (pending.empty())
+	    break;
+
+	// channels without a descriptor make progress in the background (or
+	// not at all), so we might as well block on them.
+	auto blocking = std::find_if(pending.begin(), pending.end(),
+				     [this](const partyid_t p) {
+					 return this->_peers[p]->fd() < 0;
+				     });
+	if (blocking != pending.end()) {
+	    _peers[*blocking]->recv_wait();
+	    pending.erase(blocking);
+	    continue;
+	}
+
+	fds.clear();
+	for (auto p : pending)
+	    fds.push_back({_peers[p]->fd(), POLLIN, 0});
+
+	if (poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR)
+	    throw std::runtime_error("poll");
+    }
+
+    for (auto p : senders)
+	_peers[p]->recv_wait();
+}
+
+void Network::broadcast_send(const vector<u8> &buf, broadcast_algorithm algorithm) const
+{
+    broadcast_send(std::make_shared<buffer_t>(buf), algorithm);
+}
+
+void Network::broadcast_send(buffer_t &&buf, broadcast_algorithm algorithm) const
+{
+    broadcast_send(std::make_shared<buffer_t>(std::move(buf)), algorithm);
+}
 
-    for (size_t i = 0; i < size(); i++)
-	recv_from((partyid_t)i, rbufs[i]);
+// Binomial tree over ranks relative to the broadcaster, which has rank 0. The
+// parent of rank r is r with its lowest set bit cleared, and its children are
+// r + 2^k for every 2^k below that bit. Larger subtrees come first.
+vector<size_t> tree_children(const size_t rank, const size_t n)
+{
+    size_t bound = 1;
+    if (rank)
+	bound = rank & -rank;
+    else
+	while (bound < n)
+	    bound <<= 1;
 
-    // sender.join();
+    vector<size_t> children;
+    for (size_t mask = bound >> 1; mask > 0; mask >>= 1) {
+	if (rank + mask < n)
+	    children.push_back(rank + mask);
+    }
+    return children;
 }
 
-void Network::broadcast_send(const vector<u8> &buf) const
+void Network::broadcast_send(std::shared_ptr<const buffer_t> buf,
+			     broadcast_algorithm algorithm) const
 {
     NCOMM_DEBUG("broadcast_send()");
-    for (auto &peer : _peers)
-	peer->send(buf);
+    TraceScope trace(_trace_session, "broadcast_send", -1, buf->size());
+
+    auto party = [this](const size_t rank) {
+	return (this->id() + rank) % this->size();
+    };
+
+    begin_batch();
+
+    if (algorithm == FLAT) {
+	for (auto &peer : _peers)
+	    peer->send(buf);
+    } else if (algorithm == TREE) {
+	_peers[id()]->send(buf);
+	for (auto c : tree_children(0, size()))
+	    _peers[party(c)]->send(buf);
+    } else {
+	_peers[id()]->send(buf);
+	for (size_t offset = 0; size() > 1 && offset < buf->size(); offset += NCOMM_BROADCAST_CHUNK) {
+	    const size_t n = std::min((size_t)NCOMM_BROADCAST_CHUNK, buf->size() - offset);
+	    _peers[party(1)]->send(buffer_t(buf->begin() + offset, buf->begin() + offset + n));
+	}
+    }
+
+    end_batch();
 }
 
-void Network::broadcast_recv(const partyid_t broadcaster, vector<u8> &buf) const
+void Network::broadcast_recv(const partyid_t broadcaster, vector<u8> &buf,
+			     broadcast_algorithm algorithm) const
 {
     NCOMM_DEBUG("broadcast_recv()");
     assert (broadcaster < size());
-    _peers[broadcaster]->recv(buf);
+    TraceScope trace(_trace_session, "broadcast_recv", broadcaster, buf.size());
+    count_round();
+
+    if (algorithm == FLAT || broadcaster == id()) {
+	_peers[broadcaster]->recv(buf);
+	return;
+    }
+
+    const size_t rank = (id() + size() - broadcaster) % size();
+    auto party = [this, broadcaster](const size_t r) {
+	return (broadcaster + r) % this->size();
+    };
+
+    if (algorithm == TREE) {
+	_peers[party(rank & (rank - 1))]->recv(buf);
+
+	auto children = tree_children(rank, size());
+	if (children.empty())
+	    return;
+
+	// one copy for all children.
+	auto copy = std::make_shared<const buffer_t>(buf);
+	begin_batch();
+	for (auto c : children)
+	    _peers[party(c)]->send(copy);
+	end_batch();
+	return;
+    }
+
+    // pass each chunk on as soon as we have it, so that all links of the
+    // chain are busy at once.
+    const bool last = rank == size() - 1;
+    for (size_t offset = 0; offset < buf.size(); offset += NCOMM_BROADCAST_CHUNK) {
+	buffer_t chunk (std::min((size_t)NCOMM_BROADCAST_CHUNK, buf.size() - offset));
+	_peers[party(rank - 1)]->recv(chunk);
+	std::copy(chunk.begin(), chunk.end(), buf.begin() + offset);
+	if (!last)
+	    _peers[party(rank + 1)]->send(std::move(chunk));
+    }
 }
 
 void Network::exchange_ring(const vector<u8> &sbuf, vector<u8> &rbuf, exchange_order order) const
 {
     NCOMM_DEBUG("exchange_ring()");
+    TraceScope trace(_trace_session, "exchange_ring", -1, sbuf.size());
+    count_round();
 
     partyid_t send_id, recv_id;
     if (order == exchange_order::INCREASING) {
@@ -188,4 +624,278 @@ void Network::exchange_ring(const vector<u8> &sbuf, vector<u8> &rbuf, exchange_o
     this->recv_from(recv_id, rbuf);
 }
 
+void Network::pipeline_ring(const partyid_t origin, vector<u8> &buf,
+			    const ring_chunk_fn &on_chunk, size_t hops,
+			    exchange_order order) const
+{
+    NCOMM_DEBUG("pipeline_ring()");
+    if (hops == 0)
+	hops = size() - 1;
+    assert (origin < size() && hops < size());
+    TraceScope trace(_trace_session, "pipeline_ring", origin, buf.size());
+    count_round();
+
+    partyid_t send_id, recv_id;
+    size_t distance;
+    if (order == exchange_order::INCREASING) {
+	send_id = ident_of_next();
+	recv_id = ident_of_prev();
+	distance = (id() + size() - origin) % size();
+    } else {
+	send_id = ident_of_prev();
+	recv_id = ident_of_next();
+	distance = (origin + size() - id()) % size();
+    }
+
+    if (distance > hops)
+	return;
+
+    for (size_t offset = 0; offset < buf.size(); offset += NCOMM_RING_CHUNK) {
+	const size_t n = std::min((size_t)NCOMM_RING_CHUNK, buf.size() - offset);
+
+	if (distance == 0) {
+	    _peers[send_id]->send(buffer_t(buf.begin() + offset, buf.begin() + offset + n));
+	    continue;
+	}
+
+	buffer_t chunk (n);
+	_peers[recv_id]->recv(chunk);
+	if (on_chunk)
+	    on_chunk(distance, offset, chunk);
+	std::copy(chunk.begin(), chunk.end(), buf.begin() + offset);
+
+	if (distance < hops)
+	    _peers[send_id]->send(std::move(chunk));
+    }
+}
+
+// receives from every other party i into data + offsets[i] up to
+// offsets[i + 1], all at once.
+static void start_receives(const vector<Channel*> &peers, const partyid_t self,
+			   u8 *data, const vector<size_t> &offsets,
+			   vector<partyid_t> &senders)
+{
+    for (size_t i = 0; i < peers.size(); i++) {
+	if (i == self)
+	    continue;
+	peers[i]->recv_start(data + offsets[i], offsets[i + 1] - offsets[i]);
+	senders.push_back(i);
+    }
+}
+
+// offsets of n blocks of m bytes each.
+static vector<size_t> block_offsets(const size_t n, const size_t m)
+{
+    vector<size_t> offsets (n + 1);
+    for (size_t b = 0; b <= n; b++)
+	offsets[b] = b * m;
+    return offsets;
+}
+
+void Network::allgather(const vector<u8> &sbuf, vector<u8> &rbuf) const
+{
+    NCOMM_DEBUG("allgather()");
+    TraceScope trace(_trace_session, "allgather", -1, sbuf.size());
+    count_round();
+
+    const size_t m = sbuf.size();
+    rbuf.resize(size() * m);
+    std::copy(sbuf.begin(), sbuf.end(), rbuf.begin() + id() * m);
+
+    const auto offsets = block_offsets(size(), m);
+
+    if (size() > 2 && m >= NCOMM_RING_THRESHOLD) {
+	ring_allgather(rbuf.data(), offsets, id());
+	return;
+    }
+
+    auto buf = std::make_shared<const buffer_t>(sbuf);
+    begin_batch();
+    for (size_t i = 0; i < size(); i++) {
+	if (i != id())
+	    _peers[i]->send(buf);
+    }
+
+    vector<partyid_t> senders;
+    start_receives(_peers, id(), rbuf.data(), offsets, senders);
+    end_batch();
+
+    wait_all(senders);
+}
+
+void Network::_allreduce(const vector<u8> &sbuf, vector<u8> &rbuf,
+			 const size_t width, const reducer_t &reduce) const
+{
+    NCOMM_DEBUG("allreduce()");
+    TraceScope trace(_trace_session, "allreduce", -1, sbuf.size());
+    count_round();
+
+    const size_t m = sbuf.size();
+    rbuf = sbuf;
+
+    // reduce-scatter followed by allgather, each moving (n - 1) / n of the
+    // buffer. Blocks are whole elements.
+    if (size() > 2 && m >= NCOMM_RING_THRESHOLD) {
+	const size_t elements = m / width;
+	vector<size_t> offsets (size() + 1);
+	for (size_t b = 0; b <= size(); b++)
+	    offsets[b] = elements * b / size() * width;
+
+	ring_reduce_scatter(rbuf.data(), offsets, reduce);
+	ring_allgather(rbuf.data(), offsets, (id() + 1) % size());
+	return;
+    }
+
+    auto buf = std::make_shared<const buffer_t>(sbuf);
+    begin_batch();
+    for (size_t i = 0; i < size(); i++) {
+	if (i != id())
+	    _peers[i]->send(buf);
+    }
+
+    // everything arrives before we reduce, so it needs space of its own.
+    vector<u8> in (size() * m);
+    const auto offsets = block_offsets(size(), m);
+    vector<partyid_t> senders;
+    start_receives(_peers, id(), in.data(), offsets, senders);
+    end_batch();
+
+    wait_all(senders);
+
+    for (auto i : senders)
+	reduce(rbuf.data(), in.data() + offsets[i], m);
+}
+
+// In step s every party passes block first - s on to the next party and
+// receives block first - s - 1 from the previous one. What we receive is
+// what we send in the next step.
+void Network::ring_allgather(u8 *data, const vector<size_t> &offsets,
+			     const size_t first) const
+{
+    const size_t n = size();
+    const partyid_t next = ident_of_next();
+    const partyid_t prev = ident_of_prev();
+
+    buffer_t out (data + offsets[first], data + offsets[first + 1]);
+
+    for (size_t s = 0; s + 1 < n; s++) {
+	const size_t b = (first + 2 * n - s - 1) % n;
+
+	_peers[next]->send(std::move(out));
+
+	buffer_t in (offsets[b + 1] - offsets[b]);
+	_peers[prev]->recv(in);
+	std::copy(in.begin(), in.end(), data + offsets[b]);
+	out = std::move(in);
+    }
+}
+
+// Same schedule as ring_allgather(), but every received block is reduced
+// with our own before it is passed on. Afterwards we hold the complete
+// reduction of block id() + 1.
+void Network::ring_reduce_scatter(u8 *data, const vector<size_t> &offsets,
+				  const reducer_t &reduce) const
+{
+    const size_t n = size();
+    const partyid_t next = ident_of_next();
+    const partyid_t prev = ident_of_prev();
+
+    buffer_t out (data + offsets[id()], data + offsets[id() + 1]);
+
+    for (size_t s = 0; s + 1 < n; s++) {
+	const size_t b = (id() + 2 * n - s - 1) % n;
+
+	_peers[next]->send(std::move(out));
+
+	buffer_t in (offsets[b + 1] - offsets[b]);
+	_peers[prev]->recv(in);
+	reduce(in.data(), data + offsets[b], in.size());
+	if (s + 2 == n)
+	    std::copy(in.begin(), in.end(), data + offsets[b]);
+	out = std::move(in);
+    }
+}
+
+void Network::scatter(const partyid_t dealer, const vector<u8> &sbuf,
+		      const vector<size_t> &offsets, vector<u8> &rbuf) const
+{
+    NCOMM_DEBUG("scatter()");
+    assert (dealer < size() && offsets.size() == size() + 1);
+    TraceScope trace(_trace_session, "scatter", dealer, offsets.back());
+    count_round();
+
+    rbuf.resize(offsets[id() + 1] - offsets[id()]);
+
+    if (id() != dealer) {
+	_peers[dealer]->recv(rbuf);
+	return;
+    }
+
+    assert (sbuf.size() >= offsets.back());
+
+    begin_batch();
+    for (size_t i = 0; i < size(); i++) {
+	if (i != id())
+	    _peers[i]->send(buffer_t(sbuf.begin() + offsets[i], sbuf.begin() + offsets[i + 1]));
+    }
+    end_batch();
+
+    std::copy(sbuf.begin() + offsets[id()], sbuf.begin() + offsets[id() + 1], rbuf.begin());
+}
+
+void Network::gather(const partyid_t collector, const vector<u8> &sbuf,
+		     const vector<size_t> &offsets, vector<u8> &rbuf) const
+{
+    NCOMM_DEBUG("gather()");
+    assert (collector < size() && offsets.size() == size() + 1);
+    assert (sbuf.size() == offsets[id() + 1] - offsets[id()]);
+    TraceScope trace(_trace_session, "gather", collector, sbuf.size());
+    count_round();
+
+    if (id() != collector) {
+	_peers[collector]->send(sbuf);
+	return;
+    }
+
+    rbuf.resize(offsets.back());
+
+    // straight into place.
+    vector<partyid_t> senders;
+    start_receives(_peers, id(), rbuf.data(), offsets, senders);
+    std::copy(sbuf.begin(), sbuf.end(), rbuf.begin() + offsets[id()]);
+    wait_all(senders);
+}
+
+void Network::_reduce_scatter(const vector<u8> &sbuf, const vector<size_t> &offsets,
+			      vector<u8> &rbuf, const reducer_t &reduce) const
+{
+    NCOMM_DEBUG("reduce_scatter()");
+    assert (offsets.size() == size() + 1 && sbuf.size() >= offsets.back());
+    TraceScope trace(_trace_session, "reduce_scatter", -1, offsets.back());
+    count_round();
+
+    const size_t m = offsets[id() + 1] - offsets[id()];
+
+    // every peer needs only its own slice from us, so this moves as much
+    // data as the ring would.
+    begin_batch();
+    for (size_t i = 0; i < size(); i++) {
+	if (i != id())
+	    _peers[i]->send(buffer_t(sbuf.begin() + offsets[i], sbuf.begin() + offsets[i + 1]));
+    }
+
+    // every peer's contribution to our slice, side by side.
+    vector<u8> in (size() * m);
+    const auto in_offsets = block_offsets(size(), m);
+    vector<partyid_t> senders;
+    start_receives(_peers, id(), in.data(), in_offsets, senders);
+    end_batch();
+
+    rbuf.assign(sbuf.begin() + offsets[id()], sbuf.begin() + offsets[id() + 1]);
+    wait_all(senders);
+
+    for (auto i : senders)
+	reduce(rbuf.data(), in.data() + in_offsets[i], m);
+}
+
 } // ncomm
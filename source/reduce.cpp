@@ -0,0 +1,74 @@
+#include "../include/ncomm.hpp"
+
+#include <cstring>
+
+namespace ncomm {
+
+// GCC vector types. With -march=native these become AVX2 (or SSE) registers,
+// and plain scalar code on targets without either.
+typedef uint8_t u8x32 __attribute__((vector_size(32)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+
+// the buffers come straight from the network, so nothing is aligned.
+template <typename V>
+static inline V load(const void *p)
+{
+    V v;
+    memcpy(&v, p, sizeof(V));
+    return v;
+}
+
+template <typename V>
+static inline void store(void *p, const V v)
+{
+    memcpy(p, &v, sizeof(V));
+}
+
+void reduce_xor(unsigned char *acc, const unsigned char *x, const size_t count)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32)
+	store(acc + i, load<u8x32>(acc + i) ^ load<u8x32>(x + i));
+    for (; i < count; i++)
+	acc[i] ^= x[i];
+}
+
+void reduce_add(uint32_t *acc, const uint32_t *x, const size_t count, const uint32_t mask)
+{
+    const u32x8 m = mask - (u32x8){};
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+	store(acc + i, (load<u32x8>(acc + i) + load<u32x8>(x + i)) & m);
+    for (; i < count; i++)
+	acc[i] = (acc[i] + x[i]) & mask;
+}
+
+void reduce_add(uint64_t *acc, const uint64_t *x, const size_t count, const uint64_t mask)
+{
+    const u64x4 m = mask - (u64x4){};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+	store(acc + i, (load<u64x4>(acc + i) + load<u64x4>(x + i)) & m);
+    for (; i < count; i++)
+	acc[i] = (acc[i] + x[i]) & mask;
+}
+
+void reduce_add_mod(uint64_t *acc, const uint64_t *x, const size_t count, const uint64_t p)
+{
+    // both inputs are below p < 2^63, so the sum cannot overflow and one
+    // conditional subtraction brings it back into range.
+    const u64x4 q = p - (u64x4){};
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+	u64x4 s = load<u64x4>(acc + i) + load<u64x4>(x + i);
+	s -= (u64x4)(s >= q) & q;
+	store(acc + i, s);
+    }
+    for (; i < count; i++) {
+	const uint64_t s = acc[i] + x[i];
+	acc[i] = s >= p ? s - p : s;
+    }
+}
+
+} // ncomm
@@ -0,0 +1,380 @@
+#include "../include/ncomm.hpp"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace ncomm {
+
+using std::vector;
+using std::string;
+
+typedef unsigned char u8;
+
+// One direction of a ShmChannel. head and tail count bytes and wrap around
+// like the indices of SPSCQueue. The data follows the struct.
+struct shm_ring_t {
+    // written by the reader
+    alignas(NCOMM_CACHE_LINE) std::atomic<uint32_t> head {0};
+    std::atomic<uint32_t> reader_waiting {0};
+    std::atomic<uint32_t> reader_closed {0};
+    // the reader polls its socket, see ShmChannel::fd().
+    std::atomic<uint32_t> reader_polling {0};
+
+    // written by the writer
+    alignas(NCOMM_CACHE_LINE) std::atomic<uint32_t> tail {0};
+    std::atomic<uint32_t> writer_waiting {0};
+    std::atomic<uint32_t> writer_closed {0};
+};
+
+static const uint32_t ring_capacity = NCOMM_SHM_RING_SIZE;
+static const size_t ring_bytes = sizeof(shm_ring_t) + ring_capacity;
+
+static inline u8 *ring_data(shm_ring_t *ring)
+{
+    return (u8 *)(ring + 1);
+}
+
+static_assert((ring_capacity & (ring_capacity - 1)) == 0,
+	      "NCOMM_SHM_RING_SIZE must be a power of two");
+
+// same protocol as SPSCQueue::wait_while() and SPSCQueue::notify(), but the
+// futex words are shared with another process.
+static void ring_wait(std::atomic<uint32_t> &word, const uint32_t value,
+		      std::atomic<uint32_t> &waiting,
+		      const std::atomic<uint32_t> &closed)
+{
+    static const int spin_limit =
+	std::thread::hardware_concurrency() > 1 ? NCOMM_SPIN_LIMIT : 0;
+
+    for (int i = 0; i < spin_limit; i++) {
+	if (word.load(std::memory_order_acquire) != value
+	    || closed.load(std::memory_order_acquire))
+	    return;
+	cpu_relax();
+    }
+
+    for (;;) {
+	waiting.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (word.load(std::memory_order_acquire) != value
+	    || closed.load(std::memory_order_acquire))
+	    break;
+	futex_wait(word, value, true);
+    }
+    waiting.store(0, std::memory_order_relaxed);
+}
+
+static void ring_notify(std::atomic<uint32_t> &word,
+			std::atomic<uint32_t> &waiting)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed)
+	&& waiting.exchange(0, std::memory_order_relaxed))
+	futex_wake(word, true);
+}
+
+static shm_ring_t *map_ring(const int fd)
+{
+    void *p = mmap(nullptr, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+	throw std::runtime_error("(shm) mmap");
+    return (shm_ring_t *)p;
+}
+
+static void write_all(const int sock, const void *data, const size_t size)
+{
+    size_t offset = 0;
+    while (offset < size) {
+	ssize_t n = ::write(sock, (const u8 *)data + offset, size - offset);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    throw std::runtime_error("(shm) handshake write");
+	offset += n;
+    }
+}
+
+static void read_all(const int sock, void *data, const size_t size)
+{
+    size_t offset = 0;
+    while (offset < size) {
+	ssize_t n = ::read(sock, (u8 *)data + offset, size - offset);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    throw std::runtime_error("(shm) handshake read");
+	offset += n;
+    }
+}
+
+static std::atomic<unsigned> shm_count {0};
+
+void ShmChannel::attach(const int sock)
+{
+    _sock = sock;
+
+    // our ring is the one we write to. Its name only has to be unique on
+    // this host and only lives until the peer has mapped it.
+    std::stringstream ss;
+    ss << "/ncomm-" << getpid() << "-" << local_id() << "-" << remote_id()
+       << "-" << shm_count.fetch_add(1);
+    const string name = ss.str();
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+	throw std::runtime_error("(shm) shm_open");
+
+    try {
+	if (ftruncate(fd, ring_bytes) < 0) {
+	    ::close(fd);
+	    throw std::runtime_error("(shm) ftruncate");
+	}
+	_out = new (map_ring(fd)) shm_ring_t;
+	::close(fd);
+
+	// swap names, map the peer's ring and wait until the peer has mapped
+	// ours.
+	const uint32_t length = htonl(name.size());
+	write_all(_sock, &length, sizeof(length));
+	write_all(_sock, name.data(), name.size());
+
+	uint32_t remote_length;
+	read_all(_sock, &remote_length, sizeof(remote_length));
+	string remote_name (ntohl(remote_length), '\0');
+	read_all(_sock, &remote_name[0], remote_name.size());
+
+	fd = shm_open(remote_name.c_str(), O_RDWR, 0);
+	if (fd < 0)
+	    throw std::runtime_error("(shm) shm_open remote");
+	_in = map_ring(fd);
+	::close(fd);
+
+	const u8 ack = 1;
+	u8 remote_ack;
+	write_all(_sock, &ack, 1);
+	read_all(_sock, &remote_ack, 1);
+    } catch (...) {
+	shm_unlink(name.c_str());
+	throw;
+    }
+
+    shm_unlink(name.c_str());
+
+    _event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _poll = epoll_create1(EPOLL_CLOEXEC);
+    if (_event < 0 || _poll < 0)
+	throw std::runtime_error("(shm) eventfd");
+    for (int fd : {_sock, _event}) {
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(_poll, EPOLL_CTL_ADD, fd, &ev) < 0)
+	    throw std::runtime_error("(shm) epoll_ctl");
+    }
+
+    _alive = true;
+    _sender = std::thread(&ShmChannel::_sender_loop, this);
+}
+
+void ShmChannel::close()
+{
+    if (!is_alive())
+	return;
+
+    _alive = false;
+
+    // flush whatever is still queued.
+    _send_queue.close();
+    if (_sender.joinable())
+	_sender.join();
+
+    _out->writer_closed.store(1, std::memory_order_release);
+    futex_wake(_out->tail, true);
+    _in->reader_closed.store(1, std::memory_order_release);
+    futex_wake(_in->head, true);
+
+    munmap(_out, ring_bytes);
+    munmap(_in, ring_bytes);
+    ::close(_poll);
+    ::close(_event);
+    ::close(_sock);
+}
+
+void ShmChannel::send(std::shared_ptr<const buffer_t> buf)
+{
+    _count_send(buf->size(), _send_queue.size() + 1);
+    _send_queue.push_back(std::move(buf));
+}
+
+void ShmChannel::send(std::shared_ptr<const buffer_t> header,
+		      std::shared_ptr<const buffer_t> payload)
+{
+    _count_send(header->size() + payload->size(), _send_queue.size() + 1);
+    _send_queue.push_back(std::move(header), std::move(payload));
+}
+
+void ShmChannel::_sender_loop()
+{
+    while (_send_queue.wait()) {
+	auto &v = _send_queue.front();
+	TraceScope trace(_trace_session, "write", remote_id(), v->size());
+	_write(v->data(), v->size());
+	_send_queue.pop_front();
+    }
+}
+
+void ShmChannel::_write(const u8 *data, size_t size)
+{
+    uint32_t tail = _out->tail.load(std::memory_order_relaxed);
+
+    while (size > 0) {
+	const uint32_t head = _out->head.load(std::memory_order_acquire);
+
+	if (tail - head == ring_capacity) {
+	    // other end is gone. Nothing sensible to do but drop the data.
+	    if (_out->reader_closed.load(std::memory_order_acquire))
+		return;
+	    ring_wait(_out->head, head, _out->writer_waiting, _out->reader_closed);
+	    continue;
+	}
+
+	const size_t offset = tail & (ring_capacity - 1);
+	const size_t n = std::min({size, (size_t)(ring_capacity - (tail - head)),
+				   ring_capacity - offset});
+	memcpy(ring_data(_out) + offset, data, n);
+
+	tail += n;
+	data += n;
+	size -= n;
+
+	_out->tail.store(tail, std::memory_order_release);
+	ring_notify(_out->tail, _out->reader_waiting);
+
+	// ring_notify() fenced already.
+	if (_out->reader_polling.load(std::memory_order_relaxed)
+	    && _out->reader_polling.exchange(0, std::memory_order_relaxed)) {
+	    const u8 wake = 1;
+	    ssize_t r = ::send(_sock, &wake, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+	    (void)r;
+	}
+    }
+}
+
+bool ShmChannel::_read(const bool block)
+{
+    uint32_t head = _in->head.load(std::memory_order_relaxed);
+
+    while (_recv_rem > 0) {
+	const uint32_t tail = _in->tail.load(std::memory_order_acquire);
+
+	if (tail == head) {
+	    // the writer might have written more right before closing.
+	    if (_in->writer_closed.load(std::memory_order_acquire)
+		&& _in->tail.load(std::memory_order_acquire) == head)
+		throw std::runtime_error("connection closed");
+	    if (!block)
+		return false;
+	    ring_wait(_in->tail, tail, _in->reader_waiting, _in->writer_closed);
+	    continue;
+	}
+
+	const size_t offset = head & (ring_capacity - 1);
+	const size_t n = std::min({_recv_rem, (size_t)(tail - head),
+				   ring_capacity - offset});
+	memcpy(_recv_buf, ring_data(_in) + offset, n);
+
+	head += n;
+	_recv_buf += n;
+	_recv_rem -= n;
+
+	_in->head.store(head, std::memory_order_release);
+	ring_notify(_in->head, _in->writer_waiting);
+    }
+
+    return true;
+}
+
+int ShmChannel::fd() const
+{
+    // whatever woke the last poll has been dealt with.
+    u8 wakes[64];
+    while (::recv(_sock, wakes, sizeof(wakes), MSG_DONTWAIT) > 0)
+	;
+    uint64_t count;
+    ssize_t r = ::read(_event, &count, sizeof(count));
+    (void)r;
+
+    _in->reader_polling.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // the writer only sends a byte for what it writes from now on.
+    if (_in->tail.load(std::memory_order_acquire) != _in->head.load(std::memory_order_relaxed)
+	|| _in->writer_closed.load(std::memory_order_acquire)) {
+	const uint64_t one = 1;
+	r = ::write(_event, &one, sizeof(one));
+    }
+
+    return _poll;
+}
+
+size_t ShmChannel::_peek(u8 *data, const size_t n, const size_t have)
+{
+    const uint32_t head = _in->head.load(std::memory_order_relaxed);
+
+    for (;;) {
+	const uint32_t tail = _in->tail.load(std::memory_order_acquire);
+
+	if (tail - head <= have) {
+	    if (_in->writer_closed.load(std::memory_order_acquire)
+		&& _in->tail.load(std::memory_order_acquire) == tail)
+		return 0;
+	    ring_wait(_in->tail, tail, _in->reader_waiting, _in->writer_closed);
+	    continue;
+	}
+
+	const size_t count = std::min(n, (size_t)(tail - head));
+	for (size_t i = 0; i < count; i++)
+	    data[i] = ring_data(_in)[(head + i) & (ring_capacity - 1)];
+	return count;
+    }
+}
+
+void ShmChannel::recv(vector<u8> &buf)
+{
+    NCOMM_DEBUG("recv %s #bytes=%ld", to_string().c_str(), buf.size());
+
+    recv_start(buf);
+    recv_wait();
+}
+
+void ShmChannel::recv_start(u8 *data, const size_t size)
+{
+    _recv_buf = data;
+    _recv_rem = size;
+    _recv_begin(size);
+}
+
+void ShmChannel::recv_wait()
+{
+    _read(true);
+    _recv_done();
+}
+
+bool ShmChannel::recv_test()
+{
+    if (!_read(false))
+	return false;
+    _recv_done();
+    return true;
+}
+
+} // ncomm
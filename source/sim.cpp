@@ -0,0 +1,190 @@
+#include "../include/ncomm.hpp"
+
+#include <algorithm>
+#include <exception>
+
+namespace ncomm {
+
+using std::vector;
+using std::string;
+
+typedef unsigned char u8;
+
+struct sim_chunk_t {
+    std::shared_ptr<const buffer_t> data;
+    size_t offset;
+    double arrival;
+};
+
+// messages in flight from one party to another.
+struct sim_pipe_t {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<sim_chunk_t> chunks;
+    bool closed = false;
+};
+
+static void advance(std::atomic<double> &clock, const double t)
+{
+    double now = clock.load();
+    while (now < t && !clock.compare_exchange_weak(now, t))
+	;
+}
+
+SimChannel::SimChannel(const channel_info_t info, const sim_link_t link,
+		       const uint64_t seed,
+		       std::shared_ptr<std::atomic<double>> clock,
+		       std::shared_ptr<sim_pipe_t> out,
+		       std::shared_ptr<sim_pipe_t> in)
+    : Channel{info},
+      _link{link},
+      _rng{seed},
+      _clock{clock},
+      _out{out},
+      _in{in}
+{}
+
+void SimChannel::close()
+{
+    if (!is_alive())
+	return;
+
+    _alive = false;
+
+    std::unique_lock<std::mutex> lock(_out->mutex);
+    _out->closed = true;
+    _out->cond.notify_all();
+}
+
+void SimChannel::send(std::shared_ptr<const buffer_t> buf)
+{
+    _count_send(buf->size(), 1);
+
+    if (buf->empty())
+	return;
+
+    // the link sends one message at a time, and each is in flight for
+    // latency seconds once it is on the wire.
+    const double start = std::max(_clock->load(), _link_free);
+    if (_link.bandwidth > 0)
+	_link_free = start + buf->size() * 8 / _link.bandwidth;
+    else
+	_link_free = start;
+
+    double arrival = _link_free + _link.latency;
+    if (_link.jitter > 0)
+	arrival += std::uniform_real_distribution<double>(0, _link.jitter)(_rng);
+    arrival = std::max(arrival, _last_arrival);
+    _last_arrival = arrival;
+
+    std::unique_lock<std::mutex> lock(_out->mutex);
+    _out->chunks.push_back({std::move(buf), 0, arrival});
+    _out->cond.notify_all();
+}
+
+void SimChannel::recv(vector<u8> &buf)
+{
+    NCOMM_DEBUG("recv %s #bytes=%ld", to_string().c_str(), buf.size());
+
+    size_t offset = 0;
+    double arrival = 0;
+
+    _recv_begin(buf.size());
+
+    std::unique_lock<std::mutex> lock(_in->mutex);
+
+    while (offset < buf.size()) {
+	_in->cond.wait(lock, [this]() {
+	    return !_in->chunks.empty() || _in->closed;
+	});
+
+	if (_in->chunks.empty())
+	    throw std::runtime_error("connection closed");
+
+	auto &c = _in->chunks.front();
+	const size_t n = std::min(c.data->size() - c.offset, buf.size() - offset);
+	std::copy_n(c.data->data() + c.offset, n, buf.data() + offset);
+	c.offset += n;
+	offset += n;
+	arrival = c.arrival;
+
+	if (c.offset == c.data->size())
+	    _in->chunks.pop_front();
+    }
+
+    lock.unlock();
+    _recv_done();
+
+    // we could not have had the data before it arrived.
+    advance(*_clock, arrival);
+}
+
+SimNetwork::SimNetwork(const size_t n, const sim_link_t link, const uint64_t seed)
+    : _n{n},
+      _seed{seed},
+      _links(n * n, link),
+      _times(n)
+{}
+
+double SimNetwork::run(const std::function<void(Network&)> &party)
+{
+    vector<std::shared_ptr<sim_pipe_t>> pipes (_n * _n);
+    for (auto &p : pipes)
+	p = std::make_shared<sim_pipe_t>();
+
+    vector<std::thread> threads;
+    vector<std::exception_ptr> errors (_n);
+
+    for (size_t i = 0; i < _n; i++) {
+	auto clock = std::make_shared<std::atomic<double>>(0);
+	vector<Channel*> peers (_n);
+
+	for (size_t j = 0; j < _n; j++) {
+	    if (i == j) {
+		peers[j] = new DummyChannel(i);
+	    } else {
+		channel_info_t info = {
+		    .local_id = (partyid_t)i,
+		    .remote_id = (partyid_t)j,
+		    .port = -1,
+		    .hostname = "",
+		    .role = i < j ? CLIENT : SERVER,
+		    .local = true
+		};
+		peers[j] = new SimChannel(info, link(i, j), _seed + i * _n + j,
+					  clock, pipes[i * _n + j], pipes[j * _n + i]);
+	    }
+	    peers[j]->connect();
+	}
+
+	network_info_t info = {
+	    .id = (partyid_t)i,
+	    .size = _n,
+	    .addrs = vector<string>(_n)
+	};
+
+	threads.emplace_back([this, i, info, peers, clock, &party, &errors]() {
+	    Network nw (info, peers);
+	    try {
+		party(nw);
+	    } catch (...) {
+		errors[i] = std::current_exception();
+	    }
+	    _times[i] = clock->load();
+	    // also lets everyone waiting on us know that we are gone.
+	    nw.close();
+	});
+    }
+
+    for (auto &t : threads)
+	t.join();
+
+    for (auto &e : errors) {
+	if (e)
+	    std::rethrow_exception(e);
+    }
+
+    return *std::max_element(_times.begin(), _times.end());
+}
+
+} // ncomm
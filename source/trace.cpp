@@ -0,0 +1,176 @@
+#include "../include/ncomm.hpp"
+
+#include <iomanip>
+#include <algorithm>
+#include <map>
+
+namespace ncomm {
+
+struct trace_event_t {
+    const char *name;
+    uint64_t ns;
+    uint64_t bytes;
+    int32_t peer;
+    char phase;
+};
+
+// events are allocated in chunks of this many as a thread records them.
+static const size_t chunk_events = 1024;
+static const size_t max_chunks = (NCOMM_TRACE_EVENTS + chunk_events - 1) / chunk_events;
+
+// The events one thread records in one session. Written only by its own
+// thread. Events below size are complete and never change again, so other
+// threads can read them without a lock.
+struct trace_buffer_t {
+    uint32_t tid;
+    uint32_t session;
+    std::atomic<trace_event_t*> chunks[max_chunks] = {};
+    std::atomic<size_t> size {0};
+    // set once the session has been ended.
+    std::atomic<bool> ended {false};
+
+    trace_event_t& at(const size_t i) const {
+	return chunks[i / chunk_events].load(std::memory_order_relaxed)[i % chunk_events];
+    };
+
+    ~trace_buffer_t() {
+	for (auto &c : chunks)
+	    delete[] c.load(std::memory_order_relaxed);
+    };
+};
+
+// The buffers of the sessions that have not been ended. They outlive their
+// threads so that the writes of a channel's sender thread can still be
+// exported after close().
+struct trace_registry_t {
+    std::mutex mutex;
+    std::map<uint32_t, std::vector<std::shared_ptr<trace_buffer_t>>> sessions;
+    std::atomic<uint32_t> next_session {0};
+    std::atomic<uint32_t> next_tid {0};
+};
+
+static trace_registry_t& registry()
+{
+    static trace_registry_t r;
+    return r;
+}
+
+// the buffer of this thread for session, or null if the session is not
+// live.
+static trace_buffer_t* local_buffer(const uint32_t session)
+{
+    thread_local uint32_t tid = registry().next_tid.fetch_add(1);
+    // a thread rarely records in more than one or two sessions at a time.
+    thread_local std::vector<std::shared_ptr<trace_buffer_t>> buffers;
+
+    for (auto &b : buffers) {
+	if (b->session == session)
+	    return b->ended.load(std::memory_order_relaxed) ? nullptr : b.get();
+    }
+
+    // let go of the buffers of ended sessions before we look up a new one.
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [](auto &b) {
+	return b->ended.load(std::memory_order_relaxed);
+    }), buffers.end());
+
+    auto &r = registry();
+    std::unique_lock<std::mutex> lock(r.mutex);
+    auto it = r.sessions.find(session);
+    if (it == r.sessions.end())
+	return nullptr;
+
+    auto b = std::make_shared<trace_buffer_t>();
+    b->tid = tid;
+    b->session = session;
+    it->second.push_back(b);
+    buffers.push_back(b);
+    return b.get();
+}
+
+uint32_t trace_new_session()
+{
+    auto &r = registry();
+    const uint32_t session = r.next_session.fetch_add(1) + 1;
+    std::unique_lock<std::mutex> lock(r.mutex);
+    r.sessions[session];
+    return session;
+}
+
+void trace_end_session(const uint32_t session)
+{
+    auto &r = registry();
+    std::unique_lock<std::mutex> lock(r.mutex);
+    auto it = r.sessions.find(session);
+    if (it == r.sessions.end())
+	return;
+
+    // threads let go of them the next time they need a new buffer, or exit.
+    for (auto &b : it->second)
+	b->ended.store(true, std::memory_order_relaxed);
+    r.sessions.erase(it);
+}
+
+void trace_event(const uint32_t session, const char *name, const char phase,
+		 const int peer, const uint64_t bytes)
+{
+    auto b = local_buffer(session);
+    if (!b)
+	return;
+
+    const size_t n = b->size.load(std::memory_order_relaxed);
+    if (n == NCOMM_TRACE_EVENTS)
+	return;
+
+    if (n % chunk_events == 0) {
+	// published to readers by the store to size below.
+	b->chunks[n / chunk_events].store(new trace_event_t[chunk_events],
+					  std::memory_order_relaxed);
+    }
+
+    // wall clock time, so that traces of parties on different hosts line up.
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    b->at(n) = {
+	.name = name,
+	.ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+	.bytes = bytes,
+	.peer = peer,
+	.phase = phase
+    };
+    b->size.store(n + 1, std::memory_order_release);
+}
+
+std::string trace_json(const uint32_t session, const unsigned party)
+{
+    std::vector<std::shared_ptr<trace_buffer_t>> buffers;
+    {
+	auto &r = registry();
+	std::unique_lock<std::mutex> lock(r.mutex);
+	auto it = r.sessions.find(session);
+	if (it != r.sessions.end())
+	    buffers = it->second;
+    }
+
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(3);
+    ss << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    ss << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << party
+       << ",\"args\":{\"name\":\"party " << party << "\"}}";
+
+    for (auto &b : buffers) {
+	const size_t n = b->size.load(std::memory_order_acquire);
+	for (size_t i = 0; i < n; i++) {
+	    const auto &e = b->at(i);
+	    ss << ",{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase
+	       << "\",\"ts\":" << e.ns / 1e3 << ",\"pid\":" << party
+	       << ",\"tid\":" << b->tid;
+	    if (e.phase == 'B')
+		ss << ",\"args\":{\"peer\":" << e.peer << ",\"bytes\":" << e.bytes << "}";
+	    ss << "}";
+	}
+    }
+
+    ss << "]}";
+    return ss.str();
+}
+
+} // ncomm
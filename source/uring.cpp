@@ -0,0 +1,622 @@
+#include "../include/ncomm.hpp"
+
+#ifdef NCOMM_HAVE_URING
+
+#include <linux/io_uring.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+namespace ncomm {
+
+using std::vector;
+
+typedef unsigned char u8;
+
+// user_data of a completion: the channel, with the lowest bit telling writes
+// from reads. Cancellations have none.
+static const uint64_t send_tag = 1;
+static const uint64_t cancel_data = 0;
+
+static inline unsigned load_acquire(const unsigned *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned *p, const unsigned v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+Uring::Uring(const size_t channels, const bool sqpoll)
+    : _sqpoll{sqpoll}
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    if (sqpoll) {
+	p.flags |= IORING_SETUP_SQPOLL;
+	p.sq_thread_idle = 1000;
+    }
+
+    const unsigned entries = std::max(64u, next_power_of_two(4 * channels));
+    _fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (_fd < 0)
+	throw std::runtime_error("io_uring_setup");
+
+    _sq_entries = p.sq_entries;
+    _sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+	_sq_size = _cq_size = std::max(_sq_size, _cq_size);
+
+    _sq_ptr = mmap(nullptr, _sq_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ptr == MAP_FAILED)
+	throw std::runtime_error("io_uring mmap");
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	_cq_ptr = _sq_ptr;
+    } else {
+	_cq_ptr = mmap(nullptr, _cq_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+	if (_cq_ptr == MAP_FAILED)
+	    throw std::runtime_error("io_uring mmap");
+    }
+
+    _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    _sqes = (struct io_uring_sqe *)mmap(nullptr, _sqes_size,
+					PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE,
+					_fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED)
+	throw std::runtime_error("io_uring mmap");
+
+    u8 *sq = (u8 *)_sq_ptr;
+    _sq_head = (unsigned *)(sq + p.sq_off.head);
+    _sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    _sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    _sq_flags = (unsigned *)(sq + p.sq_off.flags);
+    _sq_array = (unsigned *)(sq + p.sq_off.array);
+
+    u8 *cq = (u8 *)_cq_ptr;
+    _cq_head = (unsigned *)(cq + p.cq_off.head);
+    _cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    _cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    _cqes = cq + p.cq_off.cqes;
+
+    // one fixed file slot and one registered buffer per channel.
+    vector<int> fds (channels, -1);
+    if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_FILES,
+		fds.data(), fds.size()) < 0)
+	throw std::runtime_error("io_uring_register files");
+
+    _buffers_size = channels * NCOMM_URING_BUFFER_SIZE;
+    _buffers = (u8 *)mmap(nullptr, _buffers_size, PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (_buffers == MAP_FAILED)
+	throw std::runtime_error("mmap");
+
+    vector<struct iovec> iov (channels);
+    for (size_t i = 0; i < channels; i++) {
+	iov[i].iov_base = buffer(i);
+	iov[i].iov_len = NCOMM_URING_BUFFER_SIZE;
+    }
+    if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS,
+		iov.data(), iov.size()) < 0)
+	throw std::runtime_error("io_uring_register buffers");
+
+    _reaper = std::thread(&Uring::reaper_loop, this);
+}
+
+Uring::~Uring()
+{
+    {
+	// all channels are closed, so nothing is in flight and the reaper is
+	// not in the kernel.
+	std::unique_lock<std::mutex> lock(_mutex);
+	_stopping = true;
+	_cond.notify_all();
+    }
+    _reaper.join();
+
+    munmap(_buffers, _buffers_size);
+    munmap(_sqes, _sqes_size);
+    if (_cq_ptr != _sq_ptr)
+	munmap(_cq_ptr, _cq_size);
+    munmap(_sq_ptr, _sq_size);
+    ::close(_fd);
+}
+
+int Uring::enter(const unsigned to_submit, const unsigned min_complete,
+		 const unsigned flags)
+{
+    for (;;) {
+	int r = syscall(__NR_io_uring_enter, _fd, to_submit, min_complete,
+			flags, nullptr, 0);
+	if (r >= 0 || errno != EINTR)
+	    return r;
+    }
+}
+
+void Uring::register_file(const size_t index, const int sock)
+{
+    int fd = sock;
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = index;
+    update.fds = (uint64_t)&fd;
+
+    if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_FILES_UPDATE,
+		&update, 1) < 0)
+	throw std::runtime_error("io_uring_register files update");
+}
+
+u8 *Uring::buffer(const size_t index) const
+{
+    return _buffers + index * NCOMM_URING_BUFFER_SIZE;
+}
+
+struct io_uring_sqe *Uring::get_sqe()
+{
+    unsigned tail = *_sq_tail;
+    if (tail - load_acquire(_sq_head) == _sq_entries) {
+	submit();
+	while (tail - load_acquire(_sq_head) == _sq_entries) {
+	    // the kernel took all it would. Only SQPOLL's thread catches up
+	    // on its own, and we sleep until it has.
+	    if (!_sqpoll)
+		throw std::runtime_error("io_uring submission queue full");
+	    if (enter(0, 0, IORING_ENTER_SQ_WAIT) < 0)
+		throw std::runtime_error("io_uring_enter");
+	}
+    }
+
+    unsigned index = tail & *_sq_mask;
+    struct io_uring_sqe *sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    _sq_array[index] = index;
+    store_release(_sq_tail, tail + 1);
+    _to_submit++;
+
+    return sqe;
+}
+
+void Uring::submit()
+{
+    if (_to_submit == 0)
+	return;
+
+    if (_sqpoll) {
+	// the kernel picks the entries up on its own unless its thread went
+	// to sleep.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (load_acquire(_sq_flags) & IORING_SQ_NEED_WAKEUP)
+	    enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+	_to_submit = 0;
+	return;
+    }
+
+    // the kernel may take fewer entries than offered. Whatever it leaves
+    // stays counted, and goes with the next submit().
+    while (_to_submit > 0) {
+	const int r = enter(_to_submit, 0, 0);
+	if (r < 0 && (errno == EAGAIN || errno == EBUSY))
+	    return;
+	if (r < 0)
+	    throw std::runtime_error("io_uring_enter");
+	if (r == 0)
+	    return;
+	_to_submit -= r;
+    }
+}
+
+void Uring::cancel(const uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = cancel_data;
+    submit();
+}
+
+void Uring::reap()
+{
+    unsigned head = *_cq_head;
+    const unsigned tail = load_acquire(_cq_tail);
+    auto cqes = (struct io_uring_cqe *)_cqes;
+
+    for (; head != tail; head++) {
+	auto &cqe = cqes[head & *_cq_mask];
+	if (cqe.user_data == cancel_data)
+	    continue;
+	auto chl = (UringChannel *)(cqe.user_data & ~send_tag);
+	chl->complete(cqe.user_data & send_tag, cqe.res);
+    }
+
+    store_release(_cq_head, head);
+}
+
+void Uring::begin_batch()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _batch++;
+}
+
+void Uring::end_batch()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (--_batch == 0) {
+	submit();
+	_cond.notify_all();
+    }
+}
+
+void Uring::wait_for(std::unique_lock<std::mutex> &lock,
+		     const std::function<bool()> &done)
+{
+    for (;;) {
+	reap();
+	if (done()) {
+	    // completions may have queued follow-up submissions.
+	    if (_batch == 0)
+		submit();
+	    return;
+	}
+
+	// we are about to block, so there is no point in holding anything
+	// back.
+	submit();
+
+	// only one thread blocks in the kernel. The others wait for it to
+	// reap their completions.
+	if (_waiting) {
+	    _cond.wait(lock);
+	    continue;
+	}
+
+	_waiting = true;
+	lock.unlock();
+	int r = enter(0, 1, IORING_ENTER_GETEVENTS);
+	lock.lock();
+	_waiting = false;
+
+	if (r < 0)
+	    throw std::runtime_error("io_uring_enter");
+
+	reap();
+	_cond.notify_all();
+    }
+}
+
+void Uring::reaper_loop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (;;) {
+	// step in whenever writes are in flight and nobody else is blocked in
+	// the kernel to reap them.
+	_cond.wait(lock, [this]() {
+	    return _stopping || (_sends_inflight > 0 && !_waiting && _batch == 0);
+	});
+	if (_stopping)
+	    return;
+
+	submit();
+
+	_waiting = true;
+	lock.unlock();
+	int r = enter(0, 1, IORING_ENTER_GETEVENTS);
+	lock.lock();
+	_waiting = false;
+
+	if (r < 0)
+	    NCOMM_DEBUG("io_uring_enter failed: %s", strerror(errno));
+
+	reap();
+	if (_batch == 0)
+	    submit();
+	_cond.notify_all();
+    }
+}
+
+void UringChannel::attach(const int sock)
+{
+    _sock = sock;
+
+    int opt = 1;
+    if (setsockopt(_sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)))
+	throw std::runtime_error("setsockopt");
+
+    _event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _poll = epoll_create1(EPOLL_CLOEXEC);
+    if (_event < 0 || _poll < 0)
+	throw std::runtime_error("eventfd");
+    for (int fd : {_ring->_fd, _event}) {
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(_poll, EPOLL_CTL_ADD, fd, &ev) < 0)
+	    throw std::runtime_error("epoll_ctl");
+    }
+
+    std::unique_lock<std::mutex> lock(_ring->_mutex);
+    _ring->register_file(_index, _sock);
+    _alive = true;
+}
+
+void UringChannel::close()
+{
+    if (!is_alive())
+	return;
+
+    {
+	// flush whatever is still queued. A receive may never be satisfied,
+	// so that one is cancelled.
+	std::unique_lock<std::mutex> lock(_ring->_mutex);
+	if (_recv_inflight)
+	    _ring->cancel((uint64_t)this);
+	_ring->wait_for(lock, [this]() {
+	    return !_send_inflight && !_recv_inflight;
+	});
+	_ring->register_file(_index, -1);
+    }
+
+    ::close(_poll);
+    ::close(_event);
+    ::close(_sock);
+    _alive = false;
+}
+
+void UringChannel::send(std::shared_ptr<const buffer_t> buf)
+{
+    std::unique_lock<std::mutex> lock(_ring->_mutex);
+    _count_send(buf->size(), _send_queue.size() + 1);
+    _send_queue.emplace_back(std::move(buf));
+    send_queued();
+}
+
+void UringChannel::send(std::shared_ptr<const buffer_t> header,
+			std::shared_ptr<const buffer_t> payload)
+{
+    std::unique_lock<std::mutex> lock(_ring->_mutex);
+    _count_send(header->size() + payload->size(), _send_queue.size() + 1);
+    _send_queue.emplace_back(std::move(header));
+    _send_queue.emplace_back(std::move(payload));
+    send_queued();
+}
+
+void UringChannel::send_queued()
+{
+    if (!_send_inflight) {
+	submit_send();
+	// a blocked waiter would not notice our submission.
+	if (_ring->_batch == 0 || _ring->_waiting)
+	    _ring->submit();
+    }
+}
+
+void UringChannel::submit_send()
+{
+    assert (!_send_inflight);
+
+    size_t queued = 0;
+    for (auto &v : _send_queue)
+	queued += v->size();
+    queued -= _send_offset;
+
+    // pack small writes into the registered buffer.
+    if (_fixed_offset == _fixed_length && queued > 0
+	&& queued <= NCOMM_URING_BUFFER_SIZE)
+    {
+	u8 *fixed = _ring->buffer(_index);
+	size_t length = 0;
+	for (auto &v : _send_queue) {
+	    std::copy(v->begin() + _send_offset, v->end(), fixed + length);
+	    length += v->size() - _send_offset;
+	    _send_offset = 0;
+	}
+	_send_queue.clear();
+	_fixed_offset = 0;
+	_fixed_length = length;
+    }
+
+    struct io_uring_sqe *sqe;
+
+    if (_fixed_offset < _fixed_length) {
+	sqe = _ring->get_sqe();
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->addr = (uint64_t)(_ring->buffer(_index) + _fixed_offset);
+	sqe->len = _fixed_length - _fixed_offset;
+	sqe->buf_index = _index;
+    } else if (!_send_queue.empty()) {
+	size_t count = std::min(_send_queue.size(), (size_t)IOV_MAX);
+	_iov.resize(count);
+	for (size_t i = 0; i < count; i++) {
+	    auto &v = _send_queue[i];
+	    size_t offset = i == 0 ? _send_offset : 0;
+	    _iov[i].iov_base = (void *)(v->data() + offset);
+	    _iov[i].iov_len = v->size() - offset;
+	}
+
+	memset(&_msg, 0, sizeof(_msg));
+	_msg.msg_iov = _iov.data();
+	_msg.msg_iovlen = count;
+
+	sqe = _ring->get_sqe();
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->addr = (uint64_t)&_msg;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    } else {
+	return;
+    }
+
+    sqe->fd = _index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->user_data = (uint64_t)this | send_tag;
+    _send_inflight = true;
+    if (_ring->_sends_inflight++ == 0)
+	_ring->_cond.notify_all();
+}
+
+void UringChannel::submit_recv()
+{
+    struct io_uring_sqe *sqe = _ring->get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = _index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uint64_t)_recv_buf;
+    sqe->len = _recv_rem;
+    sqe->msg_flags = MSG_WAITALL;
+    sqe->user_data = (uint64_t)this;
+    _recv_inflight = true;
+}
+
+void UringChannel::complete(const bool is_send, const int res)
+{
+    if (is_send) {
+	_send_inflight = false;
+	_ring->_sends_inflight--;
+
+	if (res < 0 && (res == -EINTR || res == -EAGAIN)) {
+	    submit_send();
+	    return;
+	}
+
+	if (res < 0) {
+	    // other end is gone. Nothing sensible to do but drop the data.
+	    NCOMM_DEBUG("send failed: %s", strerror(-res));
+	    _send_queue.clear();
+	    _send_offset = 0;
+	    _fixed_offset = _fixed_length = 0;
+	    return;
+	}
+
+	size_t rem = res;
+	if (_fixed_offset < _fixed_length) {
+	    _fixed_offset += rem;
+	} else {
+	    while (!_send_queue.empty()) {
+		size_t left = _send_queue.front()->size() - _send_offset;
+		if (rem < left) {
+		    _send_offset += rem;
+		    break;
+		}
+		rem -= left;
+		_send_offset = 0;
+		_send_queue.pop_front();
+	    }
+	}
+
+	submit_send();
+    } else {
+	_recv_inflight = false;
+
+	if (res > 0) {
+	    _recv_buf += res;
+	    _recv_rem -= res;
+	} else if (res == 0 || (res != -EINTR && res != -EAGAIN)) {
+	    _eof = true;
+	}
+
+	if (_recv_rem > 0 && !_eof) {
+	    submit_recv();
+	} else if (_event_wanted) {
+	    const uint64_t one = 1;
+	    ssize_t n = ::write(_event, &one, sizeof(one));
+	    (void)n;
+	    _event_wanted = false;
+	}
+    }
+}
+
+void UringChannel::recv_start(u8 *data, const size_t size)
+{
+    std::unique_lock<std::mutex> lock(_ring->_mutex);
+    assert (!_recv_inflight);
+
+    _recv_buf = data;
+    _recv_rem = size;
+    _recv_begin(size);
+
+    if (_recv_rem > 0 && !_eof) {
+	submit_recv();
+	if (_ring->_batch == 0 || _ring->_waiting)
+	    _ring->submit();
+    }
+}
+
+int UringChannel::fd() const
+{
+    std::unique_lock<std::mutex> lock(_ring->_mutex);
+
+    uint64_t count;
+    ssize_t n = ::read(_event, &count, sizeof(count));
+    (void)n;
+
+    // a receive that is already complete must not leave the poller waiting.
+    if (_recv_inflight) {
+	_event_wanted = true;
+    } else {
+	const uint64_t one = 1;
+	n = ::write(_event, &one, sizeof(one));
+    }
+    return _poll;
+}
+
+void UringChannel::recv_wait()
+{
+    std::unique_lock<std::mutex> lock(_ring->_mutex);
+    _ring->wait_for(lock, [this]() { return !_recv_inflight; });
+
+    if (_recv_rem > 0)
+	throw std::runtime_error("connection closed");
+    _recv_done();
+}
+
+bool UringChannel::recv_test()
+{
+    std::unique_lock<std::mutex> lock(_ring->_mutex);
+    _ring->reap();
+    if (_ring->_batch == 0)
+	_ring->submit();
+    if (!_recv_inflight && _recv_rem == 0)
+	_recv_done();
+    return !_recv_inflight;
+}
+
+size_t UringChannel::_peek(u8 *data, const size_t n, const size_t have)
+{
+    // asking for one byte more than last time blocks until it arrives. No
+    // receive is in flight, so nothing else reads the socket meanwhile.
+    for (;;) {
+	ssize_t r = ::recv(_sock, data, std::min(have + 1, n), MSG_PEEK | MSG_WAITALL);
+	if (r < 0 && errno == EINTR)
+	    continue;
+	return r > (ssize_t)have ? r : 0;
+    }
+}
+
+void UringChannel::recv(vector<u8> &buf)
+{
+    NCOMM_DEBUG("recv %s #bytes=%ld", to_string().c_str(), buf.size());
+    recv_start(buf);
+    recv_wait();
+}
+
+} // ncomm
+
+#endif
@@ -3,6 +3,10 @@
 
 #include <thread>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
 
 using namespace ncomm;
 using namespace std;
@@ -59,6 +63,136 @@ TEST_CASE("DummyChannel communicate") {
 	REQUIRE(rbuf[i] == sbuf[i]);
 }
 
+TEST_CASE("DummyChannel queues messages") {
+    DummyChannel chl {42};
+
+    chl.connect();
+
+    auto shared = make_shared<buffer_t>(2, 2);
+    buffer_t owned (3, 3);
+    const u8 *data = owned.data();
+
+    chl.send(vector<u8>(1, 1));
+    chl.send(shared);
+    chl.send(std::move(owned));
+
+    vector<u8> rbuf (3);
+    chl.recv(rbuf);
+    REQUIRE(rbuf == vector<u8>(1, 1));
+    chl.recv(rbuf);
+    REQUIRE(rbuf == *shared);
+    chl.recv(rbuf);
+    REQUIRE(rbuf == vector<u8>(3, 3));
+    REQUIRE(rbuf.data() == data);
+
+    REQUIRE_THROWS(chl.recv(rbuf));
+}
+
+TEST_CASE("Histogram") {
+    Histogram h;
+
+    REQUIRE(h.count() == 0);
+    REQUIRE(h.quantile(0.5) == 0);
+
+    for (uint64_t v = 1; v <= 1000; v++)
+	h.record(v);
+
+    REQUIRE(h.count() == 1000);
+    REQUIRE(h.max() == 1000);
+    REQUIRE(h.mean() == Approx(500.5));
+
+    // buckets are within 1/8 of their values.
+    REQUIRE(h.quantile(0.5) <= 500);
+    REQUIRE(h.quantile(0.5) >= 500 - 500 / 8);
+    REQUIRE(h.quantile(1) <= 1000);
+    REQUIRE(h.quantile(1) >= 1000 - 1000 / 8);
+
+    for (uint64_t v : {0ul, 7ul, 8ul, 9ul, 1000ul, 123456789ul, ~0ul}) {
+	const int i = Histogram::bucket(v);
+	REQUIRE(i < Histogram::buckets);
+	REQUIRE(Histogram::lower_bound(i) <= v);
+	if (i + 1 < Histogram::buckets)
+	    REQUIRE(Histogram::lower_bound(i + 1) > v);
+    }
+
+    h.reset();
+    REQUIRE(h.count() == 0);
+    REQUIRE(h.to_json() == "{\"count\":0,\"mean\":0,\"p50\":0,\"p90\":0,\"p99\":0,\"p999\":0,\"max\":0,\"buckets\":[]}");
+}
+
+TEST_CASE("SPSCQueue") {
+    SPSCQueue<vector<u8>> q (4);
+
+    REQUIRE(q.empty());
+
+    const size_t n = 10000;
+    bool ordered = true;
+
+    auto consumer = [&]() {
+	size_t i = 0;
+	while (q.wait()) {
+	    auto &v = q.front();
+	    ordered = ordered and v.size() == 1 and v[0] == (u8)i;
+	    q.pop_front();
+	    i++;
+	}
+	ordered = ordered and i == n;
+    };
+
+    thread c (consumer);
+    for (size_t i = 0; i < n; i++)
+	q.push_back(vector<u8>(1, (u8)i));
+    q.close();
+    c.join();
+
+    REQUIRE(ordered);
+    REQUIRE(q.empty());
+}
+
+TEST_CASE("SPSCQueue batch pop") {
+    SPSCQueue<vector<u8>> q (4);
+
+    q.push_back(vector<u8>(1));
+    REQUIRE(q.wait());
+    q.push_back(vector<u8>(1));
+    q.push_back(vector<u8>(1));
+    REQUIRE(q.size() == 3);
+    q.pop_front(q.size());
+
+    q.close();
+    REQUIRE(!q.wait());
+}
+
+TEST_CASE("SPSCQueue overflow") {
+    SPSCQueue<vector<u8>> q (4);
+
+    // nobody consumes, so everything past the ring overflows.
+    const size_t n = 10;
+    for (size_t i = 0; i < n; i += 2)
+	q.push_back(vector<u8>(1, (u8)i), vector<u8>(1, (u8)(i + 1)));
+    REQUIRE(q.size() == (int)n);
+
+    bool ordered = true;
+    size_t i = 0;
+    while (i < n + 1) {
+	REQUIRE(q.wait());
+	const int count = q.available();
+	for (int j = 0; j < count; j++)
+	    ordered = ordered and q.at(j)[0] == (u8)(i + j);
+	q.pop_front(count);
+	i += count;
+
+	// the ring is free again, but new items must come after the rest.
+	if (i == 4)
+	    q.push_back(vector<u8>(1, (u8)n));
+    }
+
+    REQUIRE(ordered);
+    REQUIRE(q.empty());
+    q.close();
+    REQUIRE(!q.wait());
+}
+
 TEST_CASE("network info stuff") {
 
     Network nw (0, 10, 12345);
@@ -79,6 +213,7 @@ TEST_CASE("self comm 3") {
 
     auto h = [&](partyid_t id) {
 	Network nw (id, n, 5000);
+	nw.shm() = false;
 	nw.connect();
 	vector<u8> sb (10000, (u8)id);
 	vector<u8> rb (10000);
@@ -117,6 +252,7 @@ TEST_CASE("self comm 7") {
 
     auto h = [&](partyid_t id) {
 	Network nw (id, n, 5500);
+	nw.shm() = false;
 	nw.connect();
 	vector<u8> sb (10000, (u8)id);
 	vector<u8> rb (10000);
@@ -150,25 +286,205 @@ TEST_CASE("ring comm", "[3 parties]") {
 
     const size_t n = 3;
 
+    int port = 5700;
+
+    for (bool shm : {false, true}) {
+	vector<thread*> parties (n);
+	vector<bool> results (n, true);
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, n, port);
+	    nw.shm() = shm;
+	    nw.connect();
+	    vector<u8> sb (10, (u8)id);
+	    vector<u8> rb (10);
+
+	    nw.exchange_ring(sb, rb);
+
+	    for (size_t i = 0; i < rb.size(); i++) {
+		// default exchange order is downwards.
+		bool x = rb[i] == nw.ident_of_next();
+		results[id] = x and results[id];
+	    }
+	};
+
+	cout << "ring comm 3 parties\n";
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i] = new thread(h, i);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i]->join();
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    REQUIRE(results[i]);
+	}
+
+	port += n;
+    }
+}
+
+TEST_CASE("broadcast shared buffer", "[3 parties]") {
+
+    const size_t n = 3;
+
+    int port = 5800;
+
+    for (bool shm : {false, true}) {
+	vector<thread*> parties (n);
+	vector<bool> results (n, true);
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, n, port);
+	    nw.shm() = shm;
+	    nw.connect();
+	    vector<u8> rb (100);
+
+	    if (id == 0) {
+		auto sb = make_shared<buffer_t>(100, (u8)42);
+		nw.broadcast_send(sb);
+		// nobody may modify the buffer, so it is safe to keep using it.
+		results[id] = (*sb)[0] == 42;
+	    }
+
+	    nw.broadcast_recv(0, rb);
+	    for (auto &x : rb)
+		results[id] = results[id] and x == 42;
+
+	    // hand over a temporary.
+	    nw.send_to(nw.ident_of_next(), vector<u8>(100, (u8)id));
+	    nw.recv_from(nw.ident_of_prev(), rb);
+	    for (auto &x : rb)
+		results[id] = results[id] and x == nw.ident_of_prev();
+	};
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i] = new thread(h, i);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i]->join();
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    REQUIRE(results[i]);
+	}
+
+	port += n;
+    }
+}
+
+TEST_CASE("exchange all epoll", "[4 parties]") {
+
+    const size_t n = 4;
+
     vector<thread*> parties (n);
     vector<bool> results (n, true);
 
     auto h = [&](partyid_t id) {
-	Network nw (id, n, 5700);
+	Network nw (id, n, 5900);
+	nw.engine() = EPOLL;
+	nw.shm() = false;
 	nw.connect();
-	vector<u8> sb (10, (u8)id);
-	vector<u8> rb (10);
 
-	nw.exchange_ring(sb, rb);
+	// large enough to fill the socket buffers several times over.
+	vector<vector<u8>> sbufs (n, vector<u8>(1 << 22));
+	vector<vector<u8>> rbufs (n, vector<u8>(1 << 22));
+	for (size_t i = 0; i < n; i++)
+	    sbufs[i].assign(sbufs[i].size(), (u8)(id * n + i));
 
-	for (size_t i = 0; i < rb.size(); i++) {
-	    // default exchange order is downwards.
-	    bool x = rb[i] == nw.ident_of_next();
-	    results[id] = x and results[id];
+	for (size_t round = 0; round < 3; round++) {
+	    nw.exchange_all(sbufs, rbufs);
+	    for (size_t i = 0; i < n; i++) {
+		for (auto &x : rbufs[i])
+		    results[id] = results[id] and x == (u8)(i * n + id);
+	    }
+	}
+
+	nw.close();
+    };
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i] = new thread(h, i);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i]->join();
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	REQUIRE(results[i]);
+    }
+}
+
+TEST_CASE("epoll read-ahead is bounded", "[2 parties]") {
+
+    const size_t size = 4 * NCOMM_EPOLL_STAGE_SIZE;
+    vector<char> results (2, true);
+
+    auto h = [&](partyid_t id) {
+	Network nw (id, 2, 6050);
+	nw.engine() = EPOLL;
+	nw.shm() = false;
+	nw.connect();
+
+	if (id == 0) {
+	    // the receiver is late, so its reactor may only stage so much.
+	    auto c = nw.send_async(1, buffer_t(size, 42));
+	    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	    results[id] = !c.test();
+	    c.wait();
+	} else {
+	    std::this_thread::sleep_for(std::chrono::milliseconds(600));
+	    vector<u8> rbuf (size);
+	    vector<Completion> handles {nw.recv_async(0, rbuf)};
+	    wait_all(handles);
+	    results[id] = rbuf == vector<u8>(size, 42);
 	}
+
+	nw.close();
     };
 
-    cout << "ring comm 3 parties\n";
+    thread p0 (h, 0), p1 (h, 1);
+    p0.join();
+    p1.join();
+
+    REQUIRE(results[0]);
+    REQUIRE(results[1]);
+}
+
+TEST_CASE("exchange all io_uring", "[4 parties]") {
+
+    const size_t n = 4;
+
+    vector<thread*> parties (n);
+    vector<bool> results (n, true);
+
+    auto h = [&](partyid_t id) {
+	Network nw (id, n, 6100);
+	nw.engine() = URING;
+	nw.shm() = false;
+	nw.connect();
+
+	// mix of writes that go through the registered buffer and ones that
+	// do not.
+	for (size_t size : {10, 1 << 22}) {
+	    vector<vector<u8>> sbufs (n, vector<u8>(size));
+	    vector<vector<u8>> rbufs (n, vector<u8>(size));
+	    for (size_t i = 0; i < n; i++)
+		sbufs[i].assign(size, (u8)(id * n + i));
+
+	    nw.exchange_all(sbufs, rbufs);
+	    for (size_t i = 0; i < n; i++) {
+		for (auto &x : rbufs[i])
+		    results[id] = results[id] and x == (u8)(i * n + id);
+	    }
+	}
+
+	nw.close();
+    };
 
     for (size_t i = 0; i < n; i++) {
 	parties[i] = new thread(h, i);
@@ -182,3 +498,1109 @@ TEST_CASE("ring comm", "[3 parties]") {
 	REQUIRE(results[i]);
     }
 }
+
+TEST_CASE("io_uring writes progress on their own", "[2 parties]") {
+
+    // too large for the registered buffer, so the writes are still in
+    // flight when broadcast_send() returns.
+    const size_t size = 8 << 20;
+
+    double elapsed = 0;
+    bool ok = true;
+
+    auto h = [&](partyid_t id) {
+	Network nw (id, 2, 6150);
+	nw.engine() = URING;
+	nw.shm() = false;
+	nw.connect();
+
+	vector<u8> buf (size);
+	auto start = chrono::steady_clock::now();
+
+	if (id == 0) {
+	    nw.broadcast_send(make_shared<const buffer_t>(size, (u8)42), PIPELINE);
+	    // busy with something else, so nobody on our side reaps.
+	    this_thread::sleep_for(chrono::seconds(1));
+	} else {
+	    nw.broadcast_recv(0, buf, PIPELINE);
+	    elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	    ok = buf == vector<u8>(size, 42);
+	}
+
+	nw.close();
+    };
+
+    thread p0 (h, 0), p1 (h, 1);
+    p0.join();
+    p1.join();
+
+    REQUIRE(ok);
+    REQUIRE(elapsed < 0.5);
+}
+
+TEST_CASE("io_uring close cancels receives", "[2 parties]") {
+
+    std::atomic<bool> closed {false};
+    bool ok = true;
+
+    auto h = [&](partyid_t id) {
+	Network nw (id, 2, 6160);
+	nw.engine() = URING;
+	nw.shm() = false;
+	nw.connect();
+
+	if (id == 0) {
+	    // nothing ever comes, and the peer keeps the connection open.
+	    vector<u8> buf (100);
+	    auto c = nw.recv_async(1, buf);
+	    nw.close();
+	    closed = true;
+	} else {
+	    for (int i = 0; i < 200 && !closed; i++)
+		this_thread::sleep_for(chrono::milliseconds(10));
+	    ok = closed;
+	    nw.close();
+	}
+    };
+
+    thread p0 (h, 0), p1 (h, 1);
+    p0.join();
+    p1.join();
+
+    REQUIRE(ok);
+}
+
+TEST_CASE("gathered writes", "[2 parties]") {
+
+    // a bare pair of TCP channels, so nothing goes through shared memory.
+    const vector<size_t> sizes = {1 << 22, 1, 2, 3, 1 << 20, 100, 1 << 22, 7};
+    const size_t small = 2000;
+
+    bool ok = true;
+    size_t saved = 0;
+
+    auto h = [&](const partyid_t id) {
+	channel_info_t info = {
+	    .local_id = id,
+	    .remote_id = 1 - id,
+	    .port = 6200,
+	    .hostname = "127.0.0.1",
+	    .role = id == 0 ? SERVER : CLIENT,
+	    .local = true
+	};
+	TCPChannel chl (info);
+	chl.connect();
+
+	if (id == 1) {
+	    // the first large write blocks while everything behind it queues.
+	    for (size_t round = 0; round < 2; round++) {
+		for (auto size : sizes)
+		    chl.send(buffer_t(size, (u8)size));
+		for (size_t i = 0; i < small; i++)
+		    chl.send(buffer_t(1 + i % 5, (u8)i));
+	    }
+	    chl.close();
+	    saved = chl.syscalls_saved();
+	    return;
+	}
+
+	// give the sender time to queue up.
+	this_thread::sleep_for(chrono::milliseconds(50));
+	for (size_t round = 0; round < 2; round++) {
+	    for (auto size : sizes) {
+		vector<u8> buf (size);
+		chl.recv(buf);
+		ok = ok and buf == vector<u8>(size, (u8)size);
+	    }
+	    for (size_t i = 0; i < small; i++) {
+		vector<u8> buf (1 + i % 5);
+		chl.recv(buf);
+		ok = ok and buf == vector<u8>(1 + i % 5, (u8)i);
+	    }
+	}
+	chl.close();
+    };
+
+    thread server (h, 0), client (h, 1);
+    server.join();
+    client.join();
+
+    REQUIRE(ok);
+    REQUIRE(saved > 0);
+}
+
+#ifdef NCOMM_HISTOGRAMS
+TEST_CASE("receive histograms", "[2 parties]") {
+
+    // every receive is recorded once, from its start until the data is in.
+    uint64_t count = 0;
+    double mean = 0;
+
+    auto h = [&](const partyid_t id) {
+	channel_info_t info = {
+	    .local_id = id,
+	    .remote_id = 1 - id,
+	    .port = 6250,
+	    .hostname = "127.0.0.1",
+	    .role = id == 0 ? SERVER : CLIENT,
+	    .local = true
+	};
+	TCPChannel chl (info);
+	chl.connect();
+
+	if (id == 1) {
+	    this_thread::sleep_for(chrono::milliseconds(50));
+	    chl.send(vector<u8>(100));
+	    this_thread::sleep_for(chrono::milliseconds(50));
+	    chl.send_message(vector<u8>(100));
+	    chl.close();
+	    return;
+	}
+
+	// the way wait_all() drives a receive.
+	vector<u8> buf (100);
+	chl.recv_start(buf);
+	while (!chl.recv_test())
+	    this_thread::sleep_for(chrono::milliseconds(1));
+	chl.recv_wait();
+
+	chl.recv_message(buf);
+
+	count = chl.recv_histogram()->count();
+	mean = chl.recv_histogram()->mean();
+	chl.close();
+    };
+
+    thread server (h, 0), client (h, 1);
+    server.join();
+    client.join();
+
+    REQUIRE(count == 2);
+    REQUIRE(mean >= 40e6);
+}
+#endif
+
+TEST_CASE("framed messages", "[3 parties]") {
+
+    const size_t n = 3;
+    const vector<size_t> sizes = {0, 1, 127, 128, 300000};
+
+    int port = 6300;
+
+    for (int run = 0; run < 4; run++) {
+	vector<thread*> parties (n);
+	vector<bool> results (n, true);
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, n, port);
+	    // the last run goes through shared memory.
+	    nw.engine() = run < 3 ? (io_engine)run : THREADED;
+	    nw.shm() = run == 3;
+	    nw.connect();
+
+	    for (size_t i = 0; i < n; i++) {
+		for (auto size : sizes)
+		    nw.send_message_to(i, vector<u8>(size, (u8)(id + size)));
+	    }
+
+	    for (size_t i = 0; i < n; i++) {
+		for (auto size : sizes) {
+		    vector<u8> buf (7);
+		    nw.recv_message_from(i, buf);
+		    results[id] = results[id] and buf == vector<u8>(size, (u8)(i + size));
+		}
+	    }
+
+	    // header and payload count as one message.
+	    results[id] = results[id]
+		and nw.stats().total.messages_received == n * sizes.size();
+
+	    nw.close();
+	};
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i] = new thread(h, i);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i]->join();
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    REQUIRE(results[i]);
+	}
+
+	port += n;
+    }
+}
+
+TEST_CASE("unix sockets", "[3 parties]") {
+
+    const size_t n = 3;
+
+    vector<thread*> parties (n);
+    vector<bool> results (n, true);
+
+    // 0 and 2 talk to 2 over a Unix socket, 0 talks to 1 over TCP.
+    const vector<string> addrs = {"unix:/tmp", "127.0.0.1", "unix:/tmp"};
+
+    auto h = [&](partyid_t id) {
+	network_info_t info = {.id = id, .size = n, .addrs = addrs};
+	Network nw (info);
+	nw.base_port() = 6400;
+	nw.connect();
+
+	vector<vector<u8>> sbufs (n, vector<u8>(100000));
+	vector<vector<u8>> rbufs (n, vector<u8>(100000));
+	for (size_t i = 0; i < n; i++)
+	    sbufs[i].assign(sbufs[i].size(), (u8)(id * n + i));
+
+	nw.exchange_all(sbufs, rbufs);
+	for (size_t i = 0; i < n; i++) {
+	    for (auto &x : rbufs[i])
+		results[id] = results[id] and x == (u8)(i * n + id);
+	}
+
+	nw.close();
+    };
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i] = new thread(h, i);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i]->join();
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	REQUIRE(results[i]);
+    }
+}
+
+TEST_CASE("broadcast algorithms", "[7 parties]") {
+
+    // not a power of two, and a payload that does not split into whole
+    // chunks.
+    const size_t n = 7;
+    const size_t size = 2 * NCOMM_BROADCAST_CHUNK + 1000;
+
+    SimNetwork sim (n, sim_link_t());
+    vector<bool> results (n, true);
+
+    sim.run([&](Network &nw) {
+	for (auto algorithm : {FLAT, TREE, PIPELINE}) {
+	    for (partyid_t b = 0; b < n; b++) {
+		vector<u8> expected (size);
+		for (size_t i = 0; i < size; i++)
+		    expected[i] = (u8)(i * 7 + b + algorithm);
+
+		if (nw.id() == b)
+		    nw.broadcast_send(expected, algorithm);
+
+		vector<u8> rb (size);
+		nw.broadcast_recv(b, rb, algorithm);
+		results[nw.id()] = results[nw.id()] and rb == expected;
+	    }
+	}
+    });
+
+    for (size_t i = 0; i < n; i++)
+	REQUIRE(results[i]);
+}
+
+// party id's contribution to the collectives test.
+static vector<u8> contribution(const partyid_t id, const size_t size, const uint64_t p)
+{
+    vector<u8> buf (size);
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+	const uint64_t x = ((i + 1) * 0x9e3779b97f4a7c15ull + id) % p;
+	memcpy(buf.data() + i, &x, 8);
+    }
+    return buf;
+}
+
+TEST_CASE("allgather and allreduce", "[5 parties]") {
+
+    const size_t n = 5;
+    const uint64_t p = 0x7fffffffffffffe7ull;
+
+    SimNetwork sim (n, sim_link_t());
+    vector<bool> results (n, true);
+
+    sim.run([&](Network &nw) {
+	// direct and around the ring, with blocks that are not all the same
+	// size.
+	for (size_t size : {(size_t)800, (size_t)(NCOMM_RING_THRESHOLD + 8 * 13)}) {
+	    vector<vector<u8>> all;
+	    for (partyid_t i = 0; i < n; i++)
+		all.push_back(contribution(i, size, p));
+	    const auto &mine = all[nw.id()];
+
+	    vector<u8> rbuf;
+	    nw.allgather(mine, rbuf);
+	    for (partyid_t i = 0; i < n; i++)
+		results[nw.id()] = results[nw.id()]
+		    and std::equal(all[i].begin(), all[i].end(), rbuf.begin() + i * size);
+
+	    // the same reductions, one element at a time.
+	    vector<u8> x (size), a32 (size), a64 (size), a40 (size), ap (size);
+	    for (partyid_t i = 0; i < n; i++) {
+		for (size_t j = 0; j < size; j++)
+		    x[j] ^= all[i][j];
+		for (size_t j = 0; j < size; j += 4)
+		    *(uint32_t *)(a32.data() + j) += *(const uint32_t *)(all[i].data() + j);
+		for (size_t j = 0; j < size; j += 8) {
+		    const uint64_t v = *(const uint64_t *)(all[i].data() + j);
+		    *(uint64_t *)(a64.data() + j) += v;
+		    *(uint64_t *)(a40.data() + j) = (*(uint64_t *)(a40.data() + j) + v) & ((1ull << 40) - 1);
+		    *(uint64_t *)(ap.data() + j) = (*(uint64_t *)(ap.data() + j) + v) % p;
+		}
+	    }
+
+	    nw.allreduce<xor_op>(mine, rbuf);
+	    results[nw.id()] = results[nw.id()] and rbuf == x;
+	    nw.allreduce<add_op<uint32_t>>(mine, rbuf);
+	    results[nw.id()] = results[nw.id()] and rbuf == a32;
+	    nw.allreduce<add_op<uint64_t>>(mine, rbuf);
+	    results[nw.id()] = results[nw.id()] and rbuf == a64;
+
+	    nw.allreduce(mine, rbuf, add_op<uint64_t>(40));
+	    results[nw.id()] = results[nw.id()] and rbuf == a40;
+
+	    nw.allreduce(mine, rbuf, add_mod_op(p));
+	    results[nw.id()] = results[nw.id()] and rbuf == ap;
+	}
+    });
+
+    for (size_t i = 0; i < n; i++)
+	REQUIRE(results[i]);
+}
+
+TEST_CASE("scatter, gather and reduce_scatter", "[4 parties]") {
+
+    const size_t n = 4;
+    // one party gets nothing at all.
+    const vector<size_t> offsets = {0, 40, 40, 1000, 1200};
+
+    // written from several threads at once.
+    vector<char> results (n, true);
+
+    auto body = [&](Network &nw) {
+	const partyid_t id = nw.id();
+	const size_t begin = offsets[id], end = offsets[id + 1];
+
+	vector<u8> all (offsets.back());
+	for (size_t i = 0; i < all.size(); i++)
+	    all[i] = (u8)(i % 50 + id);
+
+	// party 2 deals its buffer, and party 1 puts it back together.
+	vector<u8> slice, whole;
+	nw.scatter(2, all, offsets, slice);
+	for (size_t i = begin; i < end; i++)
+	    results[id] = results[id] and slice[i - begin] == i % 50 + 2;
+
+	nw.gather(1, slice, offsets, whole);
+	if (id == 1) {
+	    for (size_t i = 0; i < whole.size(); i++)
+		results[id] = results[id] and whole[i] == i % 50 + 2;
+	}
+
+	// no byte exceeds 52, so adding 32 bit words is adding bytes.
+	nw.reduce_scatter<add_op<uint32_t>>(all, offsets, slice);
+	results[id] = results[id] and slice.size() == end - begin;
+	for (size_t i = begin; i < end; i++)
+	    results[id] = results[id] and slice[i - begin] == 4 * (i % 50) + 6;
+    };
+
+    SimNetwork sim (n, sim_link_t());
+    sim.run(body);
+
+    // and over sockets, which receive straight into the slices.
+    vector<thread> parties;
+    for (size_t i = 0; i < n; i++) {
+	parties.emplace_back([&, i]() {
+	    Network nw (i, n, 6450);
+	    nw.shm() = false;
+	    nw.connect();
+	    body(nw);
+	    nw.close();
+	});
+    }
+
+    for (auto &t : parties)
+	t.join();
+
+    for (size_t i = 0; i < n; i++)
+	REQUIRE(results[i]);
+}
+
+TEST_CASE("pipeline_ring", "[5 parties]") {
+
+    const size_t n = 5;
+    const size_t size = 3 * NCOMM_RING_CHUNK + 100;
+
+    // 1 ms and 1 Gbps per link.
+    sim_link_t link;
+    link.latency = 1e-3;
+    link.bandwidth = 1e9;
+
+    SimNetwork sim (n, link);
+    vector<bool> results (n, true);
+
+    double t = sim.run([&](Network &nw) {
+	const partyid_t id = nw.id();
+
+	// every party adds its distance from party 2 on the way.
+	vector<u8> buf (size, (u8)(10 * id));
+	size_t calls = 0;
+	nw.pipeline_ring(2, buf, [&](size_t hop, size_t offset, vector<u8> &chunk) {
+	    calls++;
+	    results[id] = results[id] and offset % NCOMM_RING_CHUNK == 0;
+	    for (auto &x : chunk)
+		x += hop;
+	});
+
+	const size_t d = (id + n - 2) % n;
+	results[id] = results[id] and calls == (d ? 4 : 0)
+	    and buf == vector<u8>(size, (u8)(20 + d * (d + 1) / 2));
+
+	// only two hops the other way. Parties 1 and 0 get the data, 4 and 3
+	// are left alone.
+	vector<u8> other (size, (u8)id);
+	nw.pipeline_ring(2, other, nullptr, 2, DECREASING);
+	results[id] = results[id] and other == vector<u8>(size, (u8)(id < 3 ? 2 : id));
+    });
+
+    for (size_t i = 0; i < n; i++)
+	REQUIRE(results[i]);
+
+    // forwarding the whole buffer hop by hop would take 4 + 2 transfers of
+    // it, where pipelining takes about 2 (and 6 latencies either way).
+    REQUIRE(t < 3 * size * 8 / 1e9 + 6 * 1e-3);
+}
+
+TEST_CASE("simulated network", "[4 parties]") {
+
+    const size_t n = 4;
+    const size_t rounds = 100;
+
+    sim_link_t wan;
+    wan.latency = 0.05;
+    wan.bandwidth = 1e9;
+
+    SimNetwork sim (n, wan);
+    vector<bool> results (n, true);
+
+    double t = sim.run([&](Network &nw) {
+	vector<vector<u8>> sbufs (n, vector<u8>(1000, (u8)nw.id()));
+	vector<vector<u8>> rbufs (n, vector<u8>(1000));
+
+	for (size_t r = 0; r < rounds; r++) {
+	    nw.exchange_all(sbufs, rbufs);
+	    for (size_t i = 0; i < n; i++)
+		results[nw.id()] = results[nw.id()] and rbufs[i] == vector<u8>(1000, (u8)i);
+	}
+    });
+
+    for (size_t i = 0; i < n; i++)
+	REQUIRE(results[i]);
+
+    // links are independent, so each round is a latency plus sending 1 kB
+    // at 1 Gbps.
+    const double round = 0.05 + 1000 * 8 / 1e9;
+    REQUIRE(t == Approx(rounds * round));
+}
+
+TEST_CASE("network stats", "[3 parties]") {
+
+    const size_t n = 3;
+
+    vector<thread*> parties (n);
+    vector<bool> results (n, true);
+
+    auto h = [&](partyid_t id) {
+	Network nw (id, n, 6500);
+	nw.shm() = false;
+	nw.connect();
+
+	vector<vector<u8>> sbufs (n, vector<u8>(100));
+	vector<vector<u8>> rbufs (n, vector<u8>(100));
+	nw.exchange_all(sbufs, rbufs);
+	nw.exchange_all(sbufs, rbufs);
+
+	auto s = nw.stats();
+	results[id] = s.rounds == 2
+	    and s.channels.size() == n
+	    and s.total.bytes_sent == 2 * n * 100
+	    and s.total.messages_sent == 2 * n
+	    and s.total.bytes_received == 2 * n * 100
+	    and s.total.messages_received == 2 * n
+	    and s.total.send_queue_high_water >= 1
+	    and s.channels[id].bytes_sent == 200;
+
+	nw.reset_stats();
+	s = nw.stats();
+	results[id] = results[id] and s.rounds == 0
+	    and s.total.bytes_sent == 0 and s.total.messages_received == 0
+	    and s.total.recv_seconds == 0;
+
+	nw.close();
+    };
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i] = new thread(h, i);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i]->join();
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	REQUIRE(results[i]);
+    }
+}
+
+TEST_CASE("trace", "[2 parties]") {
+
+    const size_t n = 2;
+
+    vector<thread*> parties (n);
+    vector<string> traces (n);
+
+    auto h = [&](partyid_t id) {
+	const string file = "/tmp/ncomm-test-trace-" + std::to_string(id) + ".json";
+
+	Network nw (id, n, 6600);
+	nw.trace_file() = file;
+	nw.shm() = false;
+	nw.connect();
+
+	vector<vector<u8>> sbufs (n, vector<u8>(100));
+	vector<vector<u8>> rbufs (n, vector<u8>(100));
+	nw.exchange_all(sbufs, rbufs);
+
+	nw.close();
+
+	std::ifstream in (file);
+	std::stringstream ss;
+	ss << in.rdbuf();
+	traces[id] = ss.str();
+	std::remove(file.c_str());
+    };
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i] = new thread(h, i);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i]->join();
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	REQUIRE(traces[i].find("\"traceEvents\"") != string::npos);
+	REQUIRE(traces[i].find("\"name\":\"connect\"") != string::npos);
+	REQUIRE(traces[i].find("\"name\":\"exchange_all\",\"ph\":\"B\"") != string::npos);
+	REQUIRE(traces[i].find("\"name\":\"exchange_all\",\"ph\":\"E\"") != string::npos);
+	REQUIRE(traces[i].find("\"name\":\"write\"") != string::npos);
+	REQUIRE(traces[i].find("\"bytes\":100") != string::npos);
+    }
+}
+
+TEST_CASE("trace sessions") {
+
+    auto count = [](const string &json) {
+	size_t c = 0;
+	for (size_t i = json.find("\"ph\":\"B\""); i != string::npos; i = json.find("\"ph\":\"B\"", i + 1))
+	    c++;
+	return c;
+    };
+
+    // a full buffer in one session does not keep the next one from
+    // recording.
+    for (size_t round = 0; round < 2; round++) {
+	const uint32_t session = trace_new_session();
+	for (size_t i = 0; i < NCOMM_TRACE_EVENTS; i++)
+	    TraceScope trace(session, "x");
+
+	REQUIRE(count(trace_json(session, 0)) == NCOMM_TRACE_EVENTS / 2);
+
+	trace_end_session(session);
+	REQUIRE(count(trace_json(session, 0)) == 0);
+	TraceScope dropped(session, "x");
+    }
+}
+
+TEST_CASE("async send and recv", "[3 parties]") {
+
+    const size_t n = 3;
+
+    for (bool shm : {true, false}) {
+	vector<thread*> parties (n);
+	vector<bool> results (n, true);
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, n, shm ? 6700 : 6710);
+	    nw.shm() = shm;
+	    nw.connect();
+
+	    vector<vector<u8>> rbufs (n, vector<u8>(1000));
+	    vector<Completion> handles;
+	    for (partyid_t i = 0; i < n; i++) {
+		handles.push_back(nw.send_async(i, vector<u8>(1000, (u8)id)));
+		handles.push_back(nw.recv_async(i, rbufs[i]));
+	    }
+
+	    wait_all(handles);
+
+	    for (partyid_t i = 0; i < n; i++)
+		results[id] = results[id] and rbufs[i] == vector<u8>(1000, (u8)i);
+	    for (auto &c : handles)
+		results[id] = results[id] and c.test();
+
+	    // one at a time, with test() until it is done.
+	    vector<u8> rb (10);
+	    auto s = nw.send_async(nw.ident_of_next(), buffer_t(10, (u8)(id + 1)));
+	    auto r = nw.recv_async(nw.ident_of_prev(), rb);
+	    s.wait();
+	    while (!r.test())
+		std::this_thread::yield();
+	    results[id] = results[id] and rb == vector<u8>(10, (u8)(nw.ident_of_prev() + 1))
+		and Completion().test();
+
+	    nw.close();
+	};
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i] = new thread(h, i);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i]->join();
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    REQUIRE(results[i]);
+	}
+    }
+}
+
+TEST_CASE("async transfers larger than the socket buffers", "[2 parties]") {
+
+    const size_t size = 64 << 20;
+
+    for (auto engine : {THREADED, URING}) {
+	vector<char> results (2, true);
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, 2, engine == URING ? 6730 : 6720);
+	    nw.engine() = engine;
+	    nw.shm() = false;
+	    nw.connect();
+
+	    // neither side gets its send out unless it drains the other's.
+	    vector<u8> rbuf (size);
+	    vector<Completion> handles;
+	    handles.push_back(nw.send_async(1 - id, buffer_t(size, (u8)id)));
+	    handles.push_back(nw.recv_async(1 - id, rbuf));
+	    wait_all(handles);
+	    results[id] = rbuf == vector<u8>(size, (u8)(1 - id));
+
+	    // the send only completes once the channel lets go of the buffer,
+	    // which nobody on our side waits for.
+	    vector<u8> small (1 << 20);
+	    if (id == 0)
+		nw.send_async(1, small).wait();
+	    else
+		nw.recv_from(0, small);
+
+	    nw.close();
+	};
+
+	thread p0 (h, 0), p1 (h, 1);
+	p0.join();
+	p1.join();
+
+	REQUIRE(results[0]);
+	REQUIRE(results[1]);
+    }
+}
+
+TEST_CASE("send bursts", "[2 parties]") {
+
+    // both sides send far more than the send queue's ring holds before
+    // receiving anything, so send() must not block.
+    const size_t count = 4 * NCOMM_SEND_QUEUE_SIZE;
+
+    for (bool shm : {false, true}) {
+	vector<char> results (2, true);
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, 2, shm ? 7010 : 7000);
+	    nw.shm() = shm;
+	    nw.connect();
+
+	    for (size_t i = 0; i < count; i++)
+		nw.send_to(1 - id, vector<u8>(1024, (u8)i));
+
+	    // exchange_with() sends from this thread too, on top of the burst.
+	    bool ok = true;
+	    vector<u8> rbuf (1024);
+	    for (size_t i = 0; i < count; i++) {
+		if (i == 0)
+		    nw.exchange_with(1 - id, vector<u8>(1024, 0xff), rbuf);
+		else
+		    nw.recv_from(1 - id, rbuf);
+		ok = ok and rbuf == vector<u8>(1024, (u8)i);
+	    }
+	    nw.recv_from(1 - id, rbuf);
+	    results[id] = ok and rbuf == vector<u8>(1024, 0xff);
+
+	    nw.close();
+	};
+
+	thread p0 (h, 0), p1 (h, 1);
+	p0.join();
+	p1.join();
+
+	REQUIRE(results[0]);
+	REQUIRE(results[1]);
+    }
+}
+
+TEST_CASE("sub networks", "[3 parties]") {
+
+    const size_t n = 3;
+    const size_t tags = 4;
+
+    for (bool shm : {true, false}) {
+	vector<thread*> parties (n);
+	vector<char> results (n * tags, true);
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, n, shm ? 6900 : 6910);
+	    nw.shm() = shm;
+	    nw.connect();
+
+	    // every tag runs its own protocol on its own thread.
+	    vector<thread> sessions;
+	    for (uint32_t tag = 0; tag < tags; tag++) {
+		sessions.emplace_back([&, tag]() {
+		    Network &sub = nw.sub(tag);
+		    bool ok = sub.id() == id and sub.size() == n;
+		    for (size_t r = 0; r < 20; r++) {
+			const size_t size = 1 + 100 * tag + r;
+			vector<vector<u8>> sbufs (n, vector<u8>(size, (u8)(id + tag)));
+			vector<vector<u8>> rbufs (n, vector<u8>(size));
+			sub.exchange_all(sbufs, rbufs);
+			for (partyid_t i = 0; i < n; i++)
+			    ok = ok and rbufs[i] == vector<u8>(size, (u8)(i + tag));
+
+			vector<u8> msg;
+			sub.send_message_to(sub.ident_of_next(), vector<u8>(tag, (u8)r));
+			sub.recv_message_from(sub.ident_of_prev(), msg);
+			ok = ok and msg == vector<u8>(tag, (u8)r);
+		    }
+		    results[id * tags + tag] = ok;
+		});
+	    }
+
+	    for (auto &t : sessions)
+		t.join();
+
+	    // two tags driven from this thread alone. Tag 0 is only sent once
+	    // tag 1 has been received, so testing tag 0 first must not block.
+	    Network &s0 = nw.sub(0), &s1 = nw.sub(1);
+	    bool ok = true;
+	    for (size_t r = 0; r < 20; r++) {
+		const size_t size = 1000 * r + 1;
+		vector<u8> r0 (size), r1 (size);
+		auto c0 = s0.recv_async(s0.ident_of_prev(), r0);
+		auto c1 = s1.recv_async(s1.ident_of_prev(), r1);
+		s1.send_to(s1.ident_of_next(), vector<u8>(size, (u8)(id + r)));
+		for (bool done = false; !done; std::this_thread::yield()) {
+		    c0.test();
+		    done = c1.test();
+		}
+		s0.send_to(s0.ident_of_next(), vector<u8>(size, (u8)(id + 2 * r)));
+		c0.wait();
+		const partyid_t prev = nw.ident_of_prev();
+		ok = ok and r1 == vector<u8>(size, (u8)(prev + r));
+		ok = ok and r0 == vector<u8>(size, (u8)(prev + 2 * r));
+	    }
+	    results[id * tags] = results[id * tags] and ok;
+
+	    nw.close();
+	};
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i] = new thread(h, i);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+	    parties[i]->join();
+	}
+
+	for (size_t i = 0; i < n * tags; i++) {
+	    REQUIRE(results[i]);
+	}
+    }
+}
+
+TEST_CASE("many threaded sub sessions", "[3 parties]") {
+
+    const size_t n = 3;
+    const size_t tags = 10;
+
+    for (io_engine engine : {THREADED, EPOLL}) {
+	vector<char> results (n * tags, true);
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, n, engine == THREADED ? 7100 : 7110);
+	    nw.engine() = engine;
+	    nw.shm() = false;
+	    nw.connect();
+
+	    // the sessions take each other's frames off the shared channels.
+	    vector<thread> sessions;
+	    for (uint32_t tag = 0; tag < tags; tag++) {
+		sessions.emplace_back([&, tag]() {
+		    Network &sub = nw.sub(tag);
+		    bool ok = true;
+		    for (size_t r = 0; r < 50; r++) {
+			const size_t size = 1 + 10 * tag + r;
+			vector<vector<u8>> sbufs (n, vector<u8>(size, (u8)(id + tag + r)));
+			vector<vector<u8>> rbufs (n, vector<u8>(size));
+			sub.exchange_all(sbufs, rbufs);
+			for (partyid_t i = 0; i < n; i++)
+			    ok = ok and rbufs[i] == vector<u8>(size, (u8)(i + tag + r));
+		    }
+		    results[id * tags + tag] = ok;
+		});
+	    }
+
+	    for (auto &t : sessions)
+		t.join();
+	    nw.close();
+	};
+
+	thread p0 (h, 0), p1 (h, 1), p2 (h, 2);
+	p0.join();
+	p1.join();
+	p2.join();
+
+	for (size_t i = 0; i < n * tags; i++) {
+	    REQUIRE(results[i]);
+	}
+    }
+}
+
+#ifdef NCOMM_HAVE_COROUTINES
+
+// one protocol instance: a few rounds over its own network.
+static Task session(Network &nw, const size_t rounds, bool &ok)
+{
+    const size_t n = nw.size();
+
+    for (size_t r = 0; r < rounds; r++) {
+	vector<vector<u8>> sbufs (n, vector<u8>(100, (u8)(nw.id() + r)));
+	vector<vector<u8>> rbufs (n, vector<u8>(100));
+	co_await nw.co_exchange_all(sbufs, rbufs);
+	for (partyid_t i = 0; i < n; i++)
+	    ok = ok and rbufs[i] == vector<u8>(100, (u8)(i + r));
+
+	vector<u8> b (1000);
+	const partyid_t broadcaster = r % n;
+	if (nw.id() == broadcaster)
+	    nw.broadcast_send(vector<u8>(1000, (u8)r), TREE);
+	co_await nw.co_broadcast_recv(broadcaster, b, TREE);
+	ok = ok and b == vector<u8>(1000, (u8)r);
+
+	vector<u8> rb (10);
+	co_await nw.co_send_to(nw.ident_of_next(), vector<u8>(10, (u8)nw.id()));
+	co_await nw.co_recv_from(nw.ident_of_prev(), rb);
+	ok = ok and rb == vector<u8>(10, (u8)nw.ident_of_prev());
+    }
+}
+
+TEST_CASE("coroutines", "[3 parties]") {
+
+    const size_t n = 3;
+    const size_t sessions = 4;
+
+    vector<thread*> parties (n);
+    vector<bool> results (n, true);
+
+    auto h = [&](partyid_t id) {
+	Network nw (id, n, 6800);
+	nw.shm() = false;
+	nw.connect();
+
+	// all sessions on this one thread, each on a sub-network of nw.
+	Scheduler sched;
+	bool oks[sessions] = {true, true, true, true};
+	for (size_t s = 0; s < sessions; s++)
+	    sched.spawn(session(nw.sub(s), 10, oks[s]));
+	sched.run();
+
+	for (size_t s = 0; s < sessions; s++)
+	    results[id] = results[id] and oks[s];
+	nw.close();
+    };
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i] = new thread(h, i);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	parties[i]->join();
+    }
+
+    for (size_t i = 0; i < n; i++) {
+	REQUIRE(results[i]);
+    }
+}
+
+// a simulated send is only done once it has been received, so this one
+// never awaits a send before its receives.
+static Task sim_session(Network &nw, const size_t rounds, bool &ok)
+{
+    const size_t n = nw.size();
+
+    for (size_t r = 0; r < rounds; r++) {
+	vector<vector<u8>> sbufs (n, vector<u8>(100, (u8)(nw.id() + r)));
+	vector<vector<u8>> rbufs (n, vector<u8>(100));
+	co_await nw.co_exchange_all(sbufs, rbufs);
+	for (partyid_t i = 0; i < n; i++)
+	    ok = ok and rbufs[i] == vector<u8>(100, (u8)(i + r));
+
+	vector<u8> rb (10);
+	nw.send_to(nw.ident_of_next(), vector<u8>(10, (u8)nw.id()));
+	co_await nw.co_recv_from(nw.ident_of_prev(), rb);
+	ok = ok and rb == vector<u8>(10, (u8)nw.ident_of_prev());
+    }
+}
+
+TEST_CASE("coroutines on simulated networks", "[3 parties]") {
+
+    // SimChannel cannot test a receive without blocking, so the scheduler
+    // has to fall back on waiting for it.
+    const size_t n = 3;
+
+    SimNetwork sim (n, sim_link_t());
+    vector<char> results (n, false);
+
+    sim.run([&](Network &nw) {
+	Scheduler sched;
+	bool ok = true;
+	sched.spawn(sim_session(nw, 5, ok));
+	sched.run();
+	results[nw.id()] = ok;
+    });
+
+    for (size_t i = 0; i < n; i++)
+	REQUIRE(results[i]);
+}
+
+static Task send_large(Network &nw, const size_t size)
+{
+    co_await nw.co_send_to(1, vector<u8>(size, 42));
+}
+
+TEST_CASE("coroutines sleep on pending sends", "[2 parties]") {
+
+    // the receiver is late, so the send stays pending for a while. The
+    // scheduler must sleep on it rather than spin.
+    const size_t size = 64 << 20;
+
+    vector<thread*> parties (2);
+    vector<bool> results (2, true);
+    double cpu = 0;
+
+    auto h = [&](partyid_t id) {
+	Network nw (id, 2, 6850);
+	nw.shm() = false;
+	nw.connect();
+
+	if (id == 0) {
+	    timespec start, end;
+	    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	    Scheduler sched;
+	    sched.spawn(send_large(nw, size));
+	    sched.run();
+	    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	    cpu = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	} else {
+	    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	    vector<u8> rb (size);
+	    nw.recv_from(0, rb);
+	    results[id] = rb == vector<u8>(size, 42);
+	}
+
+	nw.close();
+    };
+
+    for (size_t i = 0; i < 2; i++) {
+	parties[i] = new thread(h, i);
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+	parties[i]->join();
+    }
+
+    for (size_t i = 0; i < 2; i++) {
+	REQUIRE(results[i]);
+    }
+    REQUIRE(cpu < 0.25);
+}
+
+static Task recv_late(Network &nw, vector<u8> &rb)
+{
+    co_await nw.co_recv_from(1, rb);
+}
+
+TEST_CASE("coroutines sleep on pending receives", "[2 parties]") {
+
+    // the sender is late. Shared memory and io_uring receives must be
+    // polled as well as socket ones.
+    int port = 7200;
+
+    for (int run = 0; run < 3; run++) {
+	vector<bool> results (2, true);
+	double cpu = 0;
+
+	auto h = [&](partyid_t id) {
+	    Network nw (id, 2, port);
+	    nw.engine() = run == 1 ? URING : run == 2 ? EPOLL : THREADED;
+	    nw.shm() = run == 0;
+	    nw.connect();
+
+	    if (id == 0) {
+		timespec start, end;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+		vector<u8> rb (1000);
+		Scheduler sched;
+		sched.spawn(recv_late(nw, rb));
+		sched.run();
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		cpu = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+		results[id] = rb == vector<u8>(1000, 42);
+	    } else {
+		std::this_thread::sleep_for(std::chrono::milliseconds(500));
+		nw.send_to(0, vector<u8>(1000, 42));
+	    }
+
+	    nw.close();
+	};
+
+	thread p0 (h, 0), p1 (h, 1);
+	p0.join();
+	p1.join();
+
+	REQUIRE(results[0]);
+	REQUIRE(cpu < 0.25);
+
+	port += 10;
+    }
+}
+
+#endif